@@ -35,6 +35,7 @@
 #include <ulib/math_rng_zipf.h>
 #include <ulib/hash_open.h>
 #include <ulib/hash_multi_r.h>
+#include <ulib/mc_numa.h>
 #include <ulib/mc_runtime.h>
 
 static const char *usage =
@@ -43,6 +44,13 @@ static const char *usage =
 	"usage: %s [options]\n"
 	"options:\n"
 	"  -t<ntask>   - number of tasks, default is ncpu\n"
+	"  -g<grain>   - steal work over grain chunks per task, default is off\n"
+	"  -c<nslot>   - per-worker combining cache slots, default is off\n"
+	"  -b	       - enqueue the pairs in batches\n"
+	"  -H	       - combine per socket first\n"
+	"  -N	       - place the data and sub-tables on the nodes of their workers, use with -g\n"
+	"  -x<limit>   - split sub-tables of more than limit keys, default is off\n"
+	"  -l<limit>   - proxy hands off after limit items, default is unbounded\n"
 	"  -k<nslot>   - number of slots, default is ncpu^2\n"
 	"  -n<size>    - dataset size in elements, default is 10000000\n"
 	"  -r<range>   - the range of value, default is 0x10000\n"
@@ -175,9 +183,13 @@ class wc_splitter : public splitter<wc_chunk> {
 public:
 	// range: range for every element
 	// s: distribution parameter -- the exponent
-	wc_splitter(size_t size, size_t range, float s)
+	// pool: if not NULL, the workers of pool first-touch the data
+	// in the ranges they are dealt by the steal scheduler
+	wc_splitter(size_t size, size_t range, float s, worker_pool *pool = NULL)
 		: _buf(new int[size]), _size(size)
 	{
+		if (pool)
+			first_touch(*pool, _buf, size * sizeof(int));
 		zipf_rng rng;
 		zipf_rng_init(&rng, range, s);
 		for (size_t i = 0; i < size; ++i)
@@ -217,6 +229,13 @@ int main(int argc, char *argv[])
 {
 	int    oc;
 	size_t ntask = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t grain = 0;
+	size_t cache = 0;
+	bool batch = false;
+	bool socket = false;
+	bool numa = false;
+	size_t split = 0;
+	size_t limit = 0;
 	size_t nslot = sysconf(_SC_NPROCESSORS_ONLN);
 	int    range = 0x10000;
 	float  s     = 0.0;
@@ -226,10 +245,31 @@ int main(int argc, char *argv[])
 
 	nslot *= nslot;
 
-	while ((oc = getopt(argc, argv, "t:k:n:r:s:w:zh")) != -1) {
+	while ((oc = getopt(argc, argv, "t:g:c:bHNx:l:k:n:r:s:w:zh")) != -1) {
 		switch (oc) {
 		case 't':
-			ntask = std::min((size_t)strtoul(optarg, 0, 10), ntask);
+			ntask = strtoul(optarg, 0, 10);
+			break;
+		case 'g':
+			grain = strtoul(optarg, 0, 10);
+			break;
+		case 'c':
+			cache = strtoul(optarg, 0, 10);
+			break;
+		case 'b':
+			batch = true;
+			break;
+		case 'H':
+			socket = true;
+			break;
+		case 'N':
+			numa = true;
+			break;
+		case 'x':
+			split = strtoul(optarg, 0, 10);
+			break;
+		case 'l':
+			limit = strtoul(optarg, 0, 10);
 			break;
 		case 'k':
 			nslot = strtoul(optarg, 0, 10);
@@ -268,9 +308,19 @@ int main(int argc, char *argv[])
 	typedef open_hash_map<Runtime::key_type, Runtime::value_type> Counter;
 
 	// three elements of a computation
-	Splitter splitter(size, range, s);
-	Pipeline pipeline(nslot);
-	Runtime	 runtime(splitter, pipeline);
+	worker_pool pool;
+	Splitter splitter(size, range, s, numa? &pool: NULL);
+	Pipeline *pl = numa? new Pipeline(nslot, pool, range): new Pipeline(nslot);
+	Pipeline &pipeline = *pl;
+	Runtime	 runtime(splitter, pipeline, pool);
+
+	if (grain)
+		runtime.set_schedule(schedule_steal, grain);
+	runtime.set_cache(cache);
+	runtime.set_batch(batch);
+	runtime.set_socket_combining(socket);
+	pipeline.set_split(split);
+	pipeline.set_proxy_limit(limit);
 
 	timespec timer;
 	timer_start(&timer);
@@ -324,5 +374,6 @@ int main(int argc, char *argv[])
 		fprintf(stderr, "forward check OK\n");
 	}
 
+	delete pl;
 	return 0;
 }
@@ -42,6 +42,8 @@ static const char *usage =
 	"usage: %s [options]\n"
 	"options:\n"
 	"  -t<ntask>   - number of tasks, default is ncpu\n"
+	"  -g<grain>   - steal work over grain chunks per task, default is off\n"
+	"  -c<nslot>   - per-worker combining cache slots, default is off\n"
 	"  -k<nslot>   - number of slots, default is 10000000\n"
 	"  -l<nlock>   - number of locks, default is 128\n"
 	"  -n<size>    - dataset size in elements, default is 10000000\n"
@@ -217,6 +219,8 @@ int main(int argc, char *argv[])
 {
 	int    oc;
 	size_t ntask = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t grain = 0;
+	size_t cache = 0;
 	size_t nslot = 10000000;
 	size_t nlock = 128;
 	int    range = 0x10000;
@@ -225,10 +229,16 @@ int main(int argc, char *argv[])
 	bool   check = false;
 	char  * file = NULL;
 
-	while ((oc = getopt(argc, argv, "t:k:l:n:r:s:w:zh")) != -1) {
+	while ((oc = getopt(argc, argv, "t:g:c:k:l:n:r:s:w:zh")) != -1) {
 		switch (oc) {
 		case 't':
-			ntask = std::min((size_t)strtoul(optarg, 0, 10), ntask);
+			ntask = strtoul(optarg, 0, 10);
+			break;
+		case 'g':
+			grain = strtoul(optarg, 0, 10);
+			break;
+		case 'c':
+			cache = strtoul(optarg, 0, 10);
 			break;
 		case 'k':
 			nslot = strtoul(optarg, 0, 10);
@@ -274,6 +284,10 @@ int main(int argc, char *argv[])
 	Storage	 storage(nslot, nlock);
 	Runtime	 runtime(splitter, storage);
 
+	if (grain)
+		runtime.set_schedule(schedule_steal, grain);
+	runtime.set_cache(cache);
+
 	timespec timer;
 	timer_start(&timer);
 	runtime.run(ntask);
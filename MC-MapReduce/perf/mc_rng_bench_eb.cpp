@@ -0,0 +1,346 @@
+/* The MIT License
+
+   Copyright (C) 2012 Zilong Tan (eric.zltan@gmail.com)
+
+   Permission is hereby granted, free of charge, to any person
+   obtaining a copy of this software and associated documentation
+   files (the "Software"), to deal in the Software without
+   restriction, including without limitation the rights to use, copy,
+   modify, merge, publish, distribute, sublicense, and/or sell copies
+   of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <ulib/util_timer.h>
+#include <ulib/util_algo.h>
+#include <ulib/math_rng_zipf.h>
+#include <ulib/hash_open.h>
+#include <ulib/hash_multi_r.h>
+#include <ulib/mc_runtime.h>
+
+static const char *usage =
+	"The MapCombine Framework Testing\n"
+	"Copyright (C) 2012 Zilong Tan (eric.zltan@gmail.com)\n"
+	"usage: %s [options]\n"
+	"options:\n"
+	"  -t<ntask>   - number of tasks, default is ncpu\n"
+	"  -g<grain>   - steal work over grain chunks per task, default is off\n"
+	"  -c<nslot>   - per-worker combining cache slots, default is off\n"
+	"  -b	       - enqueue the pairs in batches\n"
+	"  -H	       - combine per socket first\n"
+	"  -x<limit>   - split sub-tables of more than limit keys, default is off\n"
+	"  -l<limit>   - proxy hands off after limit items, default is unbounded\n"
+	"  -k<nslot>   - number of slots, default is ncpu^2\n"
+	"  -n<size>    - dataset size in elements, default is 10000000\n"
+	"  -r<range>   - the range of value, default is 0x10000\n"
+	"  -s<exp>     - Zipf dataset parameter, default is 0\n"
+	"  -w<file>    - output data set to file\n"
+	"  -z	       - correctness check\n"
+	"  -h	       - print this message\n";
+
+using namespace std;
+using namespace ulib;
+using namespace ulib::mapcombine;
+
+// A record is a block of up to BLOCK consecutive elements, so that
+// the mapper emits a whole block at once.
+struct wc_block {
+	enum { BLOCK = 256 };
+
+	wc_block(const int *p, size_t n)
+		: pos(p), size(n) { }
+
+	const int *pos;
+	size_t size;
+};
+
+template<typename _Pipeline>
+struct wc_mapper : public psm_mapper<_Pipeline, wc_block, size_t, size_t> {
+	wc_mapper(_Pipeline &pipe)
+		: psm_mapper<_Pipeline, wc_block, size_t, size_t>(pipe)
+	{
+		for (size_t i = 0; i < wc_block::BLOCK; ++i)
+			_ones[i] = 1;
+	}
+
+	void
+	operator()(const wc_block &rec)
+	{
+		size_t keys[wc_block::BLOCK];
+		for (size_t i = 0; i < rec.size; ++i)
+			keys[i] = rec.pos[i];
+		this->emit_batch(keys, _ones, rec.size);
+	}
+
+private:
+	size_t _ones[wc_block::BLOCK];
+};
+
+class wc_chunk {
+public:
+	typedef wc_block record_type;
+
+	wc_chunk(int *start, int *end)
+		: _start(start), _end(end) { }
+
+	struct iterator {
+		iterator(const int *p = 0, const int *end = 0)
+			: _pos(p), _end(end)
+		{ }
+
+		wc_block
+		operator *()
+		{ return wc_block(_pos, step()); }
+
+		iterator &
+		operator++()
+		{
+			_pos += step();
+			return *this;
+		}
+
+		iterator
+		operator++(int)
+		{
+			iterator old = *this;
+			++*this;
+			return old;
+		}
+
+		bool
+		operator!=(const iterator &other) const
+		{ return _pos != other._pos; }
+
+		size_t
+		step() const
+		{ return std::min<size_t>(_end - _pos, wc_block::BLOCK); }
+
+		const int *_pos;
+		const int *_end;
+	};
+
+	typedef iterator const_iterator;
+
+	iterator
+	begin() const
+	{ return iterator(_start, _end); }
+
+	iterator
+	end() const
+	{ return iterator(_end, _end); }
+
+	size_t
+	size() const
+	{ return _end - _start; }
+
+private:
+	int * _start;
+	int * _end;
+};
+
+class wc_splitter : public splitter<wc_chunk> {
+public:
+	// range: range for every element
+	// s: distribution parameter -- the exponent
+	wc_splitter(size_t size, size_t range, float s)
+		: _buf(new int[size]), _size(size)
+	{
+		zipf_rng rng;
+		zipf_rng_init(&rng, range, s);
+		for (size_t i = 0; i < size; ++i)
+			_buf[i] = zipf_rng_next(&rng);
+	}
+
+	~wc_splitter()
+	{ delete [] _buf; }
+
+	// split into nchunk chunks, possibly less
+	int
+	split(size_t nchunk)
+	{
+		size_t len = _size / nchunk;
+		_parts.clear();
+		for (size_t i = 0; i < nchunk - 1; ++i)
+			_parts.push_back(pair<int*,int*>(_buf + i * len, _buf + (i + 1) * len));
+		_parts.push_back(pair<int*,int*>(_buf + (nchunk - 1) * len, _buf + _size));
+		return 0;
+	}
+
+	size_t
+	size() const
+	{ return _parts.size(); }
+
+	wc_chunk
+	chunk(size_t n) const
+	{ return wc_chunk(_parts[n].first, _parts[n].second); }
+
+private:
+	int    *_buf;
+	size_t	_size;
+	vector< pair<int*,int*> > _parts;
+};
+
+int main(int argc, char *argv[])
+{
+	int    oc;
+	size_t ntask = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t grain = 0;
+	size_t cache = 0;
+	bool batch = false;
+	bool socket = false;
+	size_t split = 0;
+	size_t limit = 0;
+	size_t nslot = sysconf(_SC_NPROCESSORS_ONLN);
+	int    range = 0x10000;
+	float  s     = 0.0;
+	size_t size  = 10000000;
+	bool   check = false;
+	char  * file = NULL;
+
+	nslot *= nslot;
+
+	while ((oc = getopt(argc, argv, "t:g:c:bHx:l:k:n:r:s:w:zh")) != -1) {
+		switch (oc) {
+		case 't':
+			ntask = strtoul(optarg, 0, 10);
+			break;
+		case 'g':
+			grain = strtoul(optarg, 0, 10);
+			break;
+		case 'c':
+			cache = strtoul(optarg, 0, 10);
+			break;
+		case 'b':
+			batch = true;
+			break;
+		case 'H':
+			socket = true;
+			break;
+		case 'x':
+			split = strtoul(optarg, 0, 10);
+			break;
+		case 'l':
+			limit = strtoul(optarg, 0, 10);
+			break;
+		case 'k':
+			nslot = strtoul(optarg, 0, 10);
+			break;
+		case 'n':
+			size  = strtoul(optarg, 0, 10);
+			break;
+		case 'r':
+			range = atoi(optarg);
+			break;
+		case 's':
+			s     = atof(optarg);
+			break;
+		case 'w':
+			file = optarg;
+			break;
+		case 'z':
+			check = true;
+			break;
+		case 'h':
+			printf(usage, argv[0]);
+			exit(EXIT_SUCCESS);
+		default:
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	typedef wc_splitter Splitter;
+
+	typedef psm_runtime<wc_splitter, size_t, size_t, wc_mapper,
+			    mapcombine::simple_partition<size_t> > Runtime;
+
+	typedef Runtime::pipeline_type Pipeline;
+
+	// for verification
+	typedef open_hash_map<Runtime::key_type, Runtime::value_type> Counter;
+
+	// three elements of a computation
+	Splitter splitter(size, range, s);
+	Pipeline pipeline(nslot);
+	Runtime	 runtime(splitter, pipeline);
+
+	if (grain)
+		runtime.set_schedule(schedule_steal, grain);
+	runtime.set_cache(cache);
+	runtime.set_batch(batch);
+	runtime.set_socket_combining(socket);
+	pipeline.set_split(split);
+	pipeline.set_proxy_limit(limit);
+
+	timespec timer;
+	timer_start(&timer);
+	runtime.run(ntask);
+	float elapsed = timer_stop(&timer);
+
+	printf("ntask=%zu, nslot=%zu, range=%d, s=%f, size=%lu, elapsed=%f\n",
+	       ntask, nslot, range, s, (unsigned long)size, elapsed);
+
+	splitter.split(1);
+	Splitter::chunk_type chunk = splitter.chunk(0);
+
+	if (file) {
+		FILE *fp = fopen(file, "wb");
+		if (fp == NULL) {
+			fprintf(stderr, "cannot open %s\n", file);
+			exit(EXIT_FAILURE);
+		}
+		for (Splitter::chunk_type::const_iterator it = chunk.begin();
+		     it != chunk.end(); ++it)
+			fwrite((*it).pos, sizeof(int), (*it).size, fp);
+		fclose(fp);
+	}
+
+	if (check) {
+		Counter counter;
+		timer_start(&timer);
+		for (Splitter::chunk_type::iterator it = chunk.begin();
+		     it != chunk.end(); ++it)
+			for (size_t i = 0; i < (*it).size; ++i)
+				++counter[(*it).pos[i]];
+		elapsed = timer_stop(&timer);
+		fprintf(stderr, "build counter successfully: %f sec\n", elapsed);
+		for (Counter::const_iterator it = counter.begin(); it != counter.end(); ++it) {
+			Pipeline::iterator pit = runtime.find(it.key());
+			if (pit == pipeline.end() || it.value() != pit.key().value()) {
+				fprintf(stderr, "expect %zu, actual %zu for key %zu\n",
+					pit.key().value(), it.value(), it.key());
+				exit(EXIT_FAILURE);
+			}
+		}
+		fprintf(stderr, "backward check OK\n");
+		for (Pipeline::const_iterator it = pipeline.begin(); it != pipeline.end(); ++it) {
+			if (it.key().value() != counter[it.key().key()]) {
+				fprintf(stderr, "expect %zu, actual %zu for key %zu\n",
+					counter[it.key().key()], it.key().value(), it.key().key());
+				exit(EXIT_FAILURE);
+			}
+		}
+		fprintf(stderr, "forward check OK\n");
+	}
+
+	return 0;
+}
@@ -43,7 +43,10 @@ static const char *usage =
 	"usage: %s [options]\n"
 	"options:\n"
 	"  -t<ntask>   - number of tasks, default is ncpu\n"
+	"  -g<grain>   - steal work over grain chunks per task, default is off\n"
+	"  -c<nslot>   - per-worker combining cache slots, default is off\n"
 	"  -k<nslot>   - number of slots, default is ncpu^2\n"
+	"  -j<nworker> - number of pool workers, default is ncpu\n"
 	"  -n<size>    - dataset size in elements, default is 10000000\n"
 	"  -r<range>   - the range of value, default is 0x10000\n"
 	"  -s<exp>     - Zipf dataset parameter, default is 0\n"
@@ -221,7 +224,10 @@ int main(int argc, char *argv[])
 {
 	int    oc;
 	size_t ntask = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t grain = 0;
+	size_t cache = 0;
 	size_t nslot = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t nworker = 0;
 	int    range = 0x10000;
 	float  s     = 0.0;
 	size_t size  = 10000000;
@@ -230,14 +236,23 @@ int main(int argc, char *argv[])
 
 	nslot *= nslot;
 
-	while ((oc = getopt(argc, argv, "t:k:n:r:s:w:zh")) != -1) {
+	while ((oc = getopt(argc, argv, "t:g:c:k:j:n:r:s:w:zh")) != -1) {
 		switch (oc) {
 		case 't':
-			ntask = std::min((size_t)strtoul(optarg, 0, 10), ntask);
+			ntask = strtoul(optarg, 0, 10);
+			break;
+		case 'g':
+			grain = strtoul(optarg, 0, 10);
+			break;
+		case 'c':
+			cache = strtoul(optarg, 0, 10);
 			break;
 		case 'k':
 			nslot = strtoul(optarg, 0, 10);
 			break;
+		case 'j':
+			nworker = strtoul(optarg, 0, 10);
+			break;
 		case 'n':
 			size  = strtoul(optarg, 0, 10);
 			break;
@@ -274,7 +289,12 @@ int main(int argc, char *argv[])
 	// three elements of a computation
 	Splitter splitter(size, range, s);
 	Storage	 storage(nslot);
-	Runtime	 runtime(splitter, storage);
+	worker_pool pool(nworker);
+	Runtime	 runtime(splitter, storage, pool);
+
+	if (grain)
+		runtime.set_schedule(schedule_steal, grain);
+	runtime.set_cache(cache);
 
 	timespec timer;
 	timer_start(&timer);
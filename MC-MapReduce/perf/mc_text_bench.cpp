@@ -46,6 +46,12 @@ static const char *usage =
 	"usage: %s file\n"
 	"options:\n"
 	"  -t<ntask>   - number of tasks, defailt is ncpu\n"
+	"  -g<grain>   - steal work over grain chunks per task, default is off\n"
+	"  -c<nslot>   - per-worker combining cache slots, default is off\n"
+	"  -b	       - enqueue the pairs in batches\n"
+	"  -H	       - combine per socket first\n"
+	"  -x<limit>   - split sub-tables of more than limit keys, default is off\n"
+	"  -l<limit>   - proxy hands off after limit items, default is unbounded\n"
 	"  -k<nslot>   - number of slots, default is ntask^2\n"
 	"  -p	       - whether or not print the result\n"
 	"  -z	       - perform correctness check\n"
@@ -176,14 +182,26 @@ int main(int argc, char *argv[])
 {
 	int    oc;
 	size_t ntask = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t grain = 0;
+	size_t cache = 0;
+	bool batch = false;
+	bool socket = false;
+	size_t split = 0;
+	size_t limit = 0;
 	size_t nslot = 0;
 	bool   print = false;
 	bool   check = false;
 	char  * file = NULL;
 
-	while ((oc = getopt(argc, argv, "t:k:pzh")) != -1) {
+	while ((oc = getopt(argc, argv, "t:g:c:bHx:l:k:pzh")) != -1) {
 		switch (oc) {
-		case 't': ntask = std::min((size_t)strtoul(optarg, 0, 10), ntask); break;
+		case 't': ntask = strtoul(optarg, 0, 10); break;
+		case 'g': grain = strtoul(optarg, 0, 10); break;
+		case 'c': cache = strtoul(optarg, 0, 10); break;
+		case 'b': batch = true; break;
+		case 'H': socket = true; break;
+		case 'x': split = strtoul(optarg, 0, 10); break;
+		case 'l': limit = strtoul(optarg, 0, 10); break;
 		case 'k': nslot = strtoul(optarg, 0, 10); break;
 		case 'p': print = true; break;
 		case 'z': check = true; break;
@@ -224,6 +242,14 @@ int main(int argc, char *argv[])
 	wc_pipeline   pipeline(nslot);
 	wc_runtime    runtime(splitter, pipeline);
 
+	if (grain)
+		runtime.set_schedule(schedule_steal, grain);
+	runtime.set_cache(cache);
+	runtime.set_batch(batch);
+	runtime.set_socket_combining(socket);
+	pipeline.set_split(split);
+	pipeline.set_proxy_limit(limit);
+
 	ULIB_DEBUG("start MapCombine ...");
 	timespec timer;
 	timer_start(&timer);
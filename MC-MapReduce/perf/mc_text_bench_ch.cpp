@@ -46,6 +46,8 @@ static const char *usage =
 	"usage: %s file\n"
 	"options:\n"
 	"  -t<ntask>   - number of tasks, defailt is ncpu\n"
+	"  -g<grain>   - steal work over grain chunks per task, default is off\n"
+	"  -c<nslot>   - per-worker combining cache slots, default is off\n"
 	"  -k<nslot>   - number of slots, default is 10000000\n"
 	"  -l<nlock>   - number of locks, default is 128\n"
 	"  -p	       - whether or not print the result\n"
@@ -193,15 +195,19 @@ int main(int argc, char *argv[])
 {
 	int    oc;
 	size_t ntask = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t grain = 0;
+	size_t cache = 0;
 	size_t nslot = 10000000;
 	size_t nlock = 128;
 	bool   print = false;
 	bool   check = false;
 	char  * file = NULL;
 
-	while ((oc = getopt(argc, argv, "t:k:l:pzh")) != -1) {
+	while ((oc = getopt(argc, argv, "t:g:c:k:l:pzh")) != -1) {
 		switch (oc) {
-		case 't': ntask = std::min((size_t)strtoul(optarg, 0, 10), ntask); break;
+		case 't': ntask = strtoul(optarg, 0, 10); break;
+		case 'g': grain = strtoul(optarg, 0, 10); break;
+		case 'c': cache = strtoul(optarg, 0, 10); break;
 		case 'k': nslot = strtoul(optarg, 0, 10); break;
 		case 'l': nlock = strtoul(optarg, 0, 10); break;
 		case 'p': print = true; break;
@@ -241,6 +247,10 @@ int main(int argc, char *argv[])
 	wc_storage    storage(nslot, nlock);
 	wc_runtime    runtime(splitter, storage);
 
+	if (grain)
+		runtime.set_schedule(schedule_steal, grain);
+	runtime.set_cache(cache);
+
 	ULIB_DEBUG("start MapCombine ...");
 	timespec timer;
 	timer_start(&timer);
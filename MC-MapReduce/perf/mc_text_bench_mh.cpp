@@ -46,7 +46,10 @@ static const char *usage =
 	"usage: %s file\n"
 	"options:\n"
 	"  -t<ntask>   - number of tasks, defailt is ncpu\n"
+	"  -g<grain>   - steal work over grain chunks per task, default is off\n"
+	"  -c<nslot>   - per-worker combining cache slots, default is off\n"
 	"  -k<nslot>   - number of slots, default is ntask^2\n"
+	"  -j<nworker> - number of pool workers, default is ncpu\n"
 	"  -p	       - whether or not print the result\n"
 	"  -z	       - perform correctness check\n"
 	"  -h	       - print this message\n";
@@ -175,15 +178,21 @@ int main(int argc, char *argv[])
 {
 	int    oc;
 	size_t ntask = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t grain = 0;
+	size_t cache = 0;
 	size_t nslot = 0;
+	size_t nworker = 0;
 	bool   print = false;
 	bool   check = false;
 	char  * file = NULL;
 
-	while ((oc = getopt(argc, argv, "t:k:pzh")) != -1) {
+	while ((oc = getopt(argc, argv, "t:g:c:k:j:pzh")) != -1) {
 		switch (oc) {
-		case 't': ntask = std::min((size_t)strtoul(optarg, 0, 10), ntask); break;
+		case 't': ntask = strtoul(optarg, 0, 10); break;
+		case 'g': grain = strtoul(optarg, 0, 10); break;
+		case 'c': cache = strtoul(optarg, 0, 10); break;
 		case 'k': nslot = strtoul(optarg, 0, 10); break;
+		case 'j': nworker = strtoul(optarg, 0, 10); break;
 		case 'p': print = true; break;
 		case 'z': check = true; break;
 		case 'h': printf(usage, argv[0]); return 0;
@@ -221,7 +230,12 @@ int main(int argc, char *argv[])
 	ULIB_DEBUG("prepare MapCombine components ...");
 	text_splitter splitter(fmap, fmap + fs.st_size);
 	wc_storage    storage(nslot);
-	wc_runtime    runtime(splitter, storage);
+	worker_pool   pool(nworker);
+	wc_runtime    runtime(splitter, storage, pool);
+
+	if (grain)
+		runtime.set_schedule(schedule_steal, grain);
+	runtime.set_cache(cache);
 
 	ULIB_DEBUG("start MapCombine ...");
 	timespec timer;
@@ -0,0 +1,285 @@
+/* The MIT License
+
+   Copyright (C) 2012 Zilong Tan (eric.zltan@gmail.com)
+
+   Permission is hereby granted, free of charge, to any person
+   obtaining a copy of this software and associated documentation
+   files (the "Software"), to deal in the Software without
+   restriction, including without limitation the rights to use, copy,
+   modify, merge, publish, distribute, sublicense, and/or sell copies
+   of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+
+// This file implements the per-thread object pools.
+// Each thread allocates objects from its own cache without any
+// synchronization. An object freed by another thread is pushed onto
+// the remote list of the owning cache with a single CAS, and the
+// owner reclaims the whole remote list at once when its local list
+// runs dry. The memory is kept in slabs which are never returned;
+// the cache of an exiting thread is handed to the next thread that
+// needs one, so the pools only grow to the peak number of live
+// objects.
+// key_arena is a bump allocator whose memory is released only in
+// bulk, for data sharing one lifetime such as the keys of a storage.
+
+#ifndef _ULIB_MC_ALLOC_H
+#define _ULIB_MC_ALLOC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <new>
+#include <pthread.h>
+#include <ulib/os_atomic_intel64.h>
+
+namespace ulib {
+
+namespace mapcombine {
+
+// Pool of objects of type _Obj.
+template<typename _Obj>
+class object_pool {
+public:
+	// allocate storage for one object
+	static void *
+	alloc()
+	{
+		cache *c = _tls;
+		if (c == NULL)
+			c = attach();
+		block *b = c->local;
+		if (b == NULL)
+			b = c->refill();
+		c->local = b->next;
+		return b + 1;
+	}
+
+	// free storage allocated by any thread
+	static void
+	free(void *p)
+	{
+		block *b = (block *)p - 1;
+		cache *c = b->owner;
+		if (c == _tls) {
+			b->next	 = c->local;
+			c->local = b;
+			return;
+		}
+		for (;;) {
+			block *head = c->remote;
+			b->next = head;
+			if (atomic_cmpswp64(&c->remote, (int64_t)head, (int64_t)b) == (int64_t)head)
+				return;
+		}
+	}
+
+private:
+	struct cache;
+
+	// block header, the object follows it
+	struct block {
+		cache *owner;
+		block *next;
+	};
+
+	enum { SLAB_SIZE = 65536 };
+
+	struct cache {
+		cache()
+			: local(NULL), remote(NULL), orphan(NULL) { }
+
+		// get a list of free blocks, preferably freed ones
+		block *
+		refill()
+		{
+			block *b = (block *)atomic_fetchstore64(&remote, 0);
+			if (b)
+				return b;
+			size_t stride = sizeof(block) + (sizeof(_Obj) + 15) / 16 * 16;
+			size_t n = SLAB_SIZE / stride;
+			if (n == 0)
+				n = 1;
+			char *slab = (char *)malloc(stride * n);
+			if (slab == NULL)
+				throw std::bad_alloc();
+			for (size_t i = 0; i < n; ++i) {
+				b = (block *)(slab + i * stride);
+				b->owner = this;
+				b->next	 = i + 1 < n? (block *)(slab + (i + 1) * stride): NULL;
+			}
+			return (block *)slab;
+		}
+
+		block		*local;
+		block * volatile remote;
+		cache		*orphan;
+	};
+
+	// get a cache for the calling thread
+	static cache *
+	attach()
+	{
+		pthread_once(&_once, make_key);
+		pthread_mutex_lock(&_lock);
+		cache *c = _orphans;
+		if (c)
+			_orphans = c->orphan;
+		pthread_mutex_unlock(&_lock);
+		if (c == NULL)
+			c = new cache;
+		pthread_setspecific(_key, c);
+		_tls = c;
+		return c;
+	}
+
+	// the exiting thread leaves its cache to the next thread
+	static void
+	detach(void *p)
+	{
+		cache *c = (cache *)p;
+		pthread_mutex_lock(&_lock);
+		c->orphan = _orphans;
+		_orphans  = c;
+		pthread_mutex_unlock(&_lock);
+	}
+
+	static void
+	make_key()
+	{ pthread_key_create(&_key, detach); }
+
+	static __thread cache *_tls;
+	static cache	      *_orphans;
+	static pthread_key_t   _key;
+	static pthread_once_t  _once;
+	static pthread_mutex_t _lock;
+};
+
+template<typename _Obj>
+__thread typename object_pool<_Obj>::cache *object_pool<_Obj>::_tls = NULL;
+
+template<typename _Obj>
+typename object_pool<_Obj>::cache *object_pool<_Obj>::_orphans = NULL;
+
+template<typename _Obj>
+pthread_key_t object_pool<_Obj>::_key;
+
+template<typename _Obj>
+pthread_once_t object_pool<_Obj>::_once = PTHREAD_ONCE_INIT;
+
+template<typename _Obj>
+pthread_mutex_t object_pool<_Obj>::_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Bump allocator, not thread-safe.
+// Memory is carved from chunks which start at MIN_CHUNK bytes and
+// double up to MAX_CHUNK bytes, so that a few keys take little room.
+// Requests larger than a quarter of MAX_CHUNK get a chunk of their
+// own. Nothing is freed individually; clear() releases all chunks at
+// once.
+class key_arena {
+public:
+	key_arena()
+		: _chunks(NULL), _pos(NULL), _end(NULL), _next(MIN_CHUNK), _bytes(0) { }
+
+	~key_arena()
+	{ clear(); }
+
+	// n bytes aligned to ALIGN
+	void *
+	alloc(size_t n)
+	{
+		n = (n + ALIGN - 1) & ~(size_t)(ALIGN - 1);
+		if (n > MAX_CHUNK / 4)
+			return grab(n, false);
+		if ((size_t)(_end - _pos) < n) {
+			while (_next < n)
+				_next <<= 1;
+			_pos = (char *)grab(_next, true);
+			_end = _pos + _next;
+			if (_next < MAX_CHUNK)
+				_next <<= 1;
+		}
+		void *p = _pos;
+		_pos += n;
+		return p;
+	}
+
+	void
+	clear()
+	{
+		while (_chunks) {
+			chunk *c = _chunks;
+			_chunks = c->next;
+			free(c);
+		}
+		_pos   = NULL;
+		_end   = NULL;
+		_next  = MIN_CHUNK;
+		_bytes = 0;
+	}
+
+	// bytes held in chunks
+	size_t
+	bytes() const
+	{ return _bytes; }
+
+private:
+	enum { MIN_CHUNK = 1024, MAX_CHUNK = 65536, ALIGN = 8 };
+
+	// chunk header, the memory follows it
+	struct chunk {
+		chunk *next;
+		char   pad[ALIGN - sizeof(chunk *) % ALIGN];
+	};
+
+	// A new chunk of n bytes. The current chunk stays in front
+	// unless the new one replaces it, so that a large request
+	// wastes none of its room.
+	void *
+	grab(size_t n, bool current)
+	{
+		chunk *c = (chunk *)malloc(sizeof(chunk) + n);
+		if (c == NULL)
+			throw std::bad_alloc();
+		if (current || _chunks == NULL) {
+			c->next = _chunks;
+			_chunks = c;
+		} else {
+			c->next = _chunks->next;
+			_chunks->next = c;
+		}
+		_bytes += n;
+		return c + 1;
+	}
+
+	key_arena(const key_arena &) { }
+
+	key_arena &
+	operator= (const key_arena &)
+	{ return *this; }
+
+	chunk *_chunks;
+	char  *_pos;
+	char  *_end;
+	// size of the next chunk
+	size_t _next;
+	size_t _bytes;
+};
+
+}  // namespace mapcombine
+
+}  // namespace ulib
+
+#endif	/* _ULIB_MC_ALLOC_H */
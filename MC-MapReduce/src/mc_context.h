@@ -0,0 +1,888 @@
+/* The MIT License
+
+   Copyright (C) 2012 Zilong Tan (eric.zltan@gmail.com)
+
+   Permission is hereby granted, free of charge, to any person
+   obtaining a copy of this software and associated documentation
+   files (the "Software"), to deal in the Software without
+   restriction, including without limitation the rights to use, copy,
+   modify, merge, publish, distribute, sublicense, and/or sell copies
+   of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+
+// This file implements the task contexts.
+// A context sits between the mappers of a worker and the shared
+// storage or pipeline; every emit goes through the context of the
+// emitting worker. A context may hold a small direct-mapped
+// combining cache which absorbs repeated keys locally. An entry
+// reaches the shared storage only when it is evicted by another key
+// or when the worker finishes its job, which saves most of the lock
+// acquisitions and cache line transfers on skewed key distributions.
+
+#ifndef _ULIB_MC_CONTEXT_H
+#define _ULIB_MC_CONTEXT_H
+
+#include <stddef.h>
+#include <unistd.h>
+#include <new>
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <ulib/math_bit.h>
+#include <ulib/hash_open.h>
+#include <ulib/os_atomic_intel64.h>
+#include <ulib/mc_pool.h>
+#include <ulib/mc_swiss.h>
+#include <ulib/mc_storage.h>
+
+namespace ulib {
+
+namespace mapcombine {
+
+// Options of the task contexts, a context ignores those that do not
+// apply to it.
+struct context_config {
+	context_config()
+		: cache(0), batch(false) { }
+
+	bool
+	operator==(const context_config &other) const
+	{ return cache == other.cache && batch == other.batch; }
+
+	// number of combining cache slots, zero disables the cache
+	size_t cache;
+	// deliver the data to PSM queues, or combine them into the
+	// storage, in batches
+	bool   batch;
+};
+
+// Direct-mapped combining cache.
+//     _Entry: pair-like entry with the key as first and the value
+//     as second
+//     _Combiner: value combiner
+// Each key maps to exactly one slot by its hash; a different key
+// hitting an occupied slot evicts the resident entry.
+template<typename _Entry, typename _Combiner>
+class combine_cache {
+public:
+	typedef _Entry	  entry_type;
+	typedef _Combiner combiner_type;
+
+	// nslot: number of slots, rounded up to a power of two; zero
+	// disables the cache
+	combine_cache(size_t nslot)
+		: _mask(0), _used(0), _entries(NULL), _hashes(NULL), _valid(NULL)
+	{
+		if (nslot == 0)
+			return;
+		if (sizeof(nslot) == 8)
+			ROUND_UP64(nslot);
+		else
+			ROUND_UP32(nslot);
+		_mask	 = nslot - 1;
+		_entries = (_Entry *)::operator new(sizeof(_Entry) * nslot);
+		_hashes	 = new size_t [nslot];
+		_valid	 = new bool [nslot];
+		for (size_t i = 0; i < nslot; ++i)
+			_valid[i] = false;
+	}
+
+	~combine_cache()
+	{
+		if (_entries == NULL)
+			return;
+		for (size_t i = 0; i <= _mask; ++i)
+			if (_valid[i])
+				_entries[i].~_Entry();
+		::operator delete(_entries);
+		delete [] _hashes;
+		delete [] _valid;
+	}
+
+	bool
+	enabled() const
+	{ return _entries != NULL; }
+
+	// Combine an entry into the cache, the evicted entry, if
+	// any, is passed to the sink.
+	template<typename _Sink>
+	void
+	combine(size_t hash, const _Entry &e, _Sink &sink)
+	{
+		size_t i = hash & _mask;
+		if (_valid[i]) {
+			if (_hashes[i] == hash && _entries[i].first == e.first) {
+				_combiner(_entries[i].second, e.second);
+				return;
+			}
+			sink(_entries[i]);
+			_entries[i].~_Entry();
+		} else {
+			_valid[i] = true;
+			++_used;
+		}
+		new (_entries + i) _Entry(e);
+		_hashes[i] = hash;
+	}
+
+	// Pass all cached entries to the sink and empty the cache.
+	template<typename _Sink>
+	void
+	flush(_Sink &sink)
+	{
+		for (size_t i = 0; _used && i <= _mask; ++i) {
+			if (_valid[i]) {
+				sink(_entries[i]);
+				_entries[i].~_Entry();
+				_valid[i] = false;
+				--_used;
+			}
+		}
+	}
+
+private:
+	combine_cache(const combine_cache &) { }
+
+	combine_cache &
+	operator= (const combine_cache &)
+	{ return *this; }
+
+	size_t	  _mask;
+	size_t	  _used;
+	_Entry	 *_entries;
+	size_t	 *_hashes;
+	bool	 *_valid;
+	_Combiner _combiner;
+};
+
+// Context of mc_mapper, combining into a shared storage. In batch
+// mode the pairs are gathered and combined BATCH at a time with
+// storage_combine_batch, which overlaps their cache misses. Batch
+// mode is ignored for storages that cannot prefetch, e.g., the ulib
+// multi_hash_map, for which it would only add a copy.
+template<typename _Storage, typename _Combiner>
+class mc_context {
+public:
+	typedef _Storage shared_type;
+	typedef typename _Storage::key_type   key_type;
+	typedef typename _Storage::value_type value_type;
+	typedef std::pair<key_type, value_type> entry_type;
+
+	enum { BATCH = 16 };
+
+	mc_context(shared_type &stor, const context_config &conf = context_config())
+		: _storage(stor), _cache(conf.cache), _batch(NULL), _nbatch(0)
+	{
+		if (conf.batch && storage_prefetches(stor))
+			_batch = (entry_type *)::operator new(sizeof(entry_type) * BATCH);
+	}
+
+	// the batch is drained when a job ends
+	~mc_context()
+	{ ::operator delete(_batch); }
+
+	void
+	combine(const key_type &key, const value_type &value)
+	{
+		if (_cache.enabled())
+			_cache.combine((size_t)key, entry_type(key, value), *this);
+		else if (_batch)
+			(*this)(entry_type(key, value));
+		else
+			_storage.combine(key, value);
+	}
+
+#if __cplusplus >= 201103L
+	// the same as above, moving the pair into the storage unless
+	// the cache or the batch takes it
+	void
+	combine(key_type &&key, value_type &&value)
+	{
+		if (_cache.enabled() || _batch)
+			combine(key, value);
+		else
+			_storage.combine(std::move(key), std::move(value));
+	}
+#endif
+
+	void
+	flush()
+	{
+		_cache.flush(*this);
+		drain();
+	}
+
+	shared_type &
+	shared()
+	{ return _storage; }
+
+	// cache sink
+	void
+	operator()(const entry_type &e)
+	{
+		if (_batch == NULL) {
+			_storage.combine(e.first, e.second);
+			return;
+		}
+		new (_batch + _nbatch++) entry_type(e);
+		if (_nbatch == BATCH)
+			drain();
+	}
+
+private:
+	mc_context(const mc_context &) { }
+
+	mc_context &
+	operator= (const mc_context &)
+	{ return *this; }
+
+	void
+	drain()
+	{
+		storage_combine_batch(_storage, _batch, _nbatch);
+		for (size_t i = 0; i < _nbatch; ++i)
+			_batch[i].~entry_type();
+		_nbatch = 0;
+	}
+
+	shared_type &_storage;
+	combine_cache<entry_type, _Combiner> _cache;
+	entry_type  *_batch;
+	size_t	     _nbatch;
+};
+
+// Context of psm_mapper, feeding a shared PSM pipeline. The data
+// carry their cached hash values. In batch mode the data are
+// gathered per queue and each full batch is enqueued at once, which
+// takes one atomic operation per batch rather than per datum.
+template<typename _Pipeline, typename _Combiner>
+class psm_context {
+public:
+	typedef _Pipeline shared_type;
+	typedef typename _Pipeline::data_type  data_type;
+	typedef typename _Pipeline::batch_type batch_type;
+
+	psm_context(shared_type &pipe, const context_config &conf = context_config())
+		: _pipeline(pipe), _cache(conf.cache), _batches(NULL)
+	{
+		if (conf.batch) {
+			_batches = new batch_type * [pipe.pipeline_capacity()];
+			for (size_t i = 0; i < pipe.pipeline_capacity(); ++i)
+				_batches[i] = NULL;
+		}
+	}
+
+	// the batches are all delivered when a job ends
+	~psm_context()
+	{ delete [] _batches; }
+
+	void
+	process(const data_type &d)
+	{
+		if (_cache.enabled())
+			_cache.combine((size_t)d, d, *this);
+		else
+			(*this)(d);
+	}
+
+	// Process the datum constructed from key and value. Unless the
+	// cache or the batches take it, the pipeline constructs the
+	// datum where it keeps it, e.g., right in its queue node,
+	// instead of copying it there.
+#if __cplusplus >= 201103L
+	template<typename _Key, typename _Val>
+	void
+	emplace(_Key &&key, _Val &&value)
+	{
+		if (_cache.enabled() || _batches)
+			process(data_type(std::forward<_Key>(key), std::forward<_Val>(value)));
+		else
+			_pipeline.shared_type::emplace(std::forward<_Key>(key), std::forward<_Val>(value));
+	}
+#else
+	template<typename _Key, typename _Val>
+	void
+	emplace(const _Key &key, const _Val &value)
+	{
+		if (_cache.enabled() || _batches)
+			process(data_type(key, value));
+		else
+			_pipeline.shared_type::emplace(key, value);
+	}
+#endif
+
+	void
+	flush()
+	{
+		_cache.flush(*this);
+		if (_batches == NULL)
+			return;
+		for (size_t i = 0; i < _pipeline.pipeline_capacity(); ++i) {
+			if (_batches[i]) {
+				_pipeline.process_batch(i, _batches[i]);
+				_batches[i] = NULL;
+			}
+		}
+	}
+
+	shared_type &
+	shared()
+	{ return _pipeline; }
+
+	// cache sink
+	void
+	operator()(const data_type &d)
+	{
+		if (_batches == NULL) {
+			// the pipeline is of the exact type, so bind
+			// statically
+			_pipeline.shared_type::process(d);
+			return;
+		}
+		size_t q = _pipeline.queue_of(d);
+		batch_type *b = _batches[q];
+		if (b == NULL)
+			b = _batches[q] = new batch_type;
+		b->push(d);
+		if (b->full()) {
+			_pipeline.process_batch(q, b);
+			_batches[q] = NULL;
+		}
+	}
+
+private:
+	psm_context(const psm_context &) { }
+
+	psm_context &
+	operator= (const psm_context &)
+	{ return *this; }
+
+	shared_type  &_pipeline;
+	combine_cache<data_type, _Combiner> _cache;
+	batch_type  **_batches;
+};
+
+// Context of the shared-nothing runtime.
+// The pairs are combined into private tables without any
+// synchronization. The tables are split into a fixed number of hash
+// partitions so that the merge phase can hand disjoint partitions to
+// the workers.
+template<typename _Storage, typename _Combiner>
+class private_context {
+public:
+	typedef _Storage shared_type;
+	typedef typename _Storage::key_type   key_type;
+	typedef typename _Storage::value_type value_type;
+	typedef typename subtable_map<key_type, value_type>::type table_type;
+
+	enum { NPART_BITS = 6, NPART = 1 << NPART_BITS };
+
+	// no option applies, the private tables already combine all
+	// pairs locally
+	private_context(shared_type &stor, const context_config & = context_config())
+		: _storage(stor) { }
+
+	void
+	combine(const key_type &key, const value_type &value)
+	{
+		// the tables index by the low hash bits, so partition
+		// by the high ones
+		table_type &t = _parts[(size_t)key >> (sizeof(size_t) * 8 - NPART_BITS)];
+		typename table_type::iterator it = t.find(key);
+		if (it == t.end())
+			t.insert(key, value);
+		else
+			_combiner(it.value(), value);
+	}
+
+	// private tables are merged after the map phase
+	void
+	flush()
+	{ }
+
+	// number of partitions
+	size_t
+	npart() const
+	{ return NPART; }
+
+	// combine partition p of all contexts into the shared
+	// storage and empty it
+	static void
+	merge(private_context *const *ctx, size_t nctx, size_t p)
+	{
+		for (size_t c = 0; c < nctx; ++c) {
+			table_type &t = ctx[c]->_parts[p];
+			for (typename table_type::iterator it = t.begin(); it != t.end(); ++it)
+				ctx[c]->_storage.combine(it.key(), it.value());
+			t.clear();
+		}
+	}
+
+	shared_type &
+	shared()
+	{ return _storage; }
+
+private:
+	private_context(const private_context &) { }
+
+	private_context &
+	operator= (const private_context &)
+	{ return *this; }
+
+	shared_type &_storage;
+	table_type   _parts[NPART];
+	_Combiner    _combiner;
+};
+
+// Context of the radix runtime.
+// The pairs are not combined during the map phase at all; they are
+// appended, with their cached hash values, to one buffer per hash
+// partition. Each partition first stages a couple of cache lines of
+// pairs in a fixed-size slot, which is flushed to the partition
+// buffer in bulk when full, so that the scattered writes of the map
+// phase stay within a cache-resident staging area. The fan-out is
+// the largest power of two for which the staging area takes no more
+// than half of the L1 data cache. In the merge phase each partition
+// is aggregated into a small private table, which stays in cache
+// since a partition only holds a fraction of the keys, and only the
+// aggregates reach the shared storage.
+template<typename _Storage, typename _Combiner>
+class radix_context {
+public:
+	typedef _Storage shared_type;
+	typedef typename _Storage::key_type   key_type;
+	typedef typename _Storage::value_type value_type;
+	typedef std::pair<key_type, value_type> entry_type;
+	typedef std::vector<entry_type> buffer_type;
+	typedef typename subtable_map<key_type, value_type>::type table_type;
+
+	enum {
+		// pairs staged per partition
+		STAGE = sizeof(entry_type) < 128? 128 / sizeof(entry_type): 1,
+		// fan-out limits in hash bits
+		MIN_BITS = 4,
+		MAX_BITS = 12
+	};
+
+	// no option applies, nothing is combined until the merge
+	// phase
+	radix_context(shared_type &stor, const context_config & = context_config())
+		: _storage(stor), _bits(fanout_bits()), _parts(npart())
+	{
+		_stage	= (entry_type *)::operator new(sizeof(entry_type) * STAGE * npart());
+		_nstage = new size_t [npart()]();
+	}
+
+	~radix_context()
+	{
+		flush();
+		::operator delete(_stage);
+		delete [] _nstage;
+	}
+
+	void
+	combine(const key_type &key, const value_type &value)
+	{
+		size_t p = (size_t)key >> (sizeof(size_t) * 8 - _bits);
+		new (_stage + p * STAGE + _nstage[p]) entry_type(key, value);
+		if (++_nstage[p] == STAGE)
+			spill(p);
+	}
+
+	// move the staged pairs to the partition buffers, which are
+	// aggregated after the map phase
+	void
+	flush()
+	{
+		for (size_t p = 0; p < npart(); ++p)
+			spill(p);
+	}
+
+	// number of partitions
+	size_t
+	npart() const
+	{ return (size_t)1 << _bits; }
+
+	// aggregate partition p of all contexts and combine the
+	// aggregates into the shared storage; the buffers keep their
+	// capacity for the next run
+	static void
+	merge(radix_context *const *ctx, size_t nctx, size_t p)
+	{
+		table_type t;
+		_Combiner combiner;
+		for (size_t c = 0; c < nctx; ++c) {
+			buffer_type &b = ctx[c]->_parts[p];
+			for (size_t i = 0; i < b.size(); ++i) {
+				typename table_type::iterator it = t.find(b[i].first);
+				if (it == t.end())
+					t.insert(b[i].first, b[i].second);
+				else
+					combiner(it.value(), b[i].second);
+			}
+			b.clear();
+		}
+		if (nctx == 0)
+			return;
+		shared_type &stor = ctx[0]->_storage;
+		for (typename table_type::iterator it = t.begin(); it != t.end(); ++it)
+			stor.combine(it.key(), it.value());
+	}
+
+	shared_type &
+	shared()
+	{ return _storage; }
+
+private:
+	radix_context(const radix_context &) { }
+
+	radix_context &
+	operator= (const radix_context &)
+	{ return *this; }
+
+	static size_t
+	fanout_bits()
+	{
+		long l1 = sysconf(_SC_LEVEL1_DCACHE_SIZE);
+		if (l1 <= 0)
+			l1 = 32768;
+		size_t bits = MIN_BITS;
+		while (bits < MAX_BITS &&
+		       ((size_t)2 << bits) * STAGE * sizeof(entry_type) <= (size_t)l1 / 2)
+			++bits;
+		return bits;
+	}
+
+	// append the staged pairs of partition p to its buffer
+	void
+	spill(size_t p)
+	{
+		entry_type *s = _stage + p * STAGE;
+		size_t n = _nstage[p];
+		_parts[p].insert(_parts[p].end(), s, s + n);
+		for (size_t i = 0; i < n; ++i)
+			s[i].~entry_type();
+		_nstage[p] = 0;
+	}
+
+	shared_type &_storage;
+	size_t	     _bits;
+	std::vector<buffer_type> _parts;
+	entry_type  *_stage;
+	size_t	    *_nstage;
+};
+
+// Single-producer single-consumer ring of entries.
+// The producer and the consumer each keep their index on a separate
+// cache line; the producer also caches the consumer index so that it
+// only reads the consumer's line when the ring seems full.
+template<typename _Entry>
+class spsc_ring {
+public:
+	enum { SIZE = 256 };
+
+	spsc_ring()
+		: _head(0), _tail(0), _head_cache(0)
+	{ _entries = (_Entry *)::operator new(sizeof(_Entry) * SIZE); }
+
+	~spsc_ring()
+	{
+		for (size_t h = _head; h != _tail; ++h)
+			_entries[h & (SIZE - 1)].~_Entry();
+		::operator delete(_entries);
+	}
+
+	// called by the producer, false if the ring is full
+	bool
+	push(const _Entry &e)
+	{
+		size_t t = _tail;
+		if (t - _head_cache == SIZE) {
+			_head_cache = _head;
+			if (t - _head_cache == SIZE)
+				return false;
+		}
+		new (_entries + (t & (SIZE - 1))) _Entry(e);
+		atomic_barrier();
+		_tail = t + 1;
+		return true;
+	}
+
+	// called by the consumer, pass all entries to f
+	template<typename _Func>
+	void
+	drain(_Func &f)
+	{
+		size_t h = _head;
+		size_t t = _tail;
+		if (h == t)
+			return;
+		atomic_barrier();
+		for (; h != t; ++h) {
+			_Entry &e = _entries[h & (SIZE - 1)];
+			f(e);
+			e.~_Entry();
+		}
+		atomic_barrier();
+		_head = h;
+	}
+
+private:
+	spsc_ring(const spsc_ring &) { }
+
+	spsc_ring &
+	operator= (const spsc_ring &)
+	{ return *this; }
+
+	// consumer line
+	volatile size_t _head;
+	char _pad0[64 - sizeof(size_t)];
+	// producer line
+	volatile size_t _tail;
+	size_t _head_cache;
+	_Entry *_entries;
+	char _pad1[64 - 2 * sizeof(size_t) - sizeof(void *)];
+};
+
+// Context of the delegation runtime.
+// Every hash partition is owned by one worker, the owner of partition
+// p being worker p mod n. A worker combines the pairs of its own
+// partitions into private tables and sends the others through SPSC
+// rings to their owners, which drain the rings every so often while
+// mapping. A pair that finds the ring full is kept by the sender and
+// collected by the owner in the merge phase, so no worker ever waits
+// for another. The tables never leave the cache of their owner.
+template<typename _Storage, typename _Combiner>
+class delegate_context {
+public:
+	typedef _Storage shared_type;
+	typedef typename _Storage::key_type   key_type;
+	typedef typename _Storage::value_type value_type;
+	typedef std::pair<key_type, value_type> entry_type;
+	typedef typename subtable_map<key_type, value_type>::type table_type;
+	typedef spsc_ring<entry_type> ring_type;
+
+	enum { NPART_BITS = 8, NPART = 1 << NPART_BITS, DRAIN_INTERVAL = 64 };
+
+	// no option applies
+	delegate_context(shared_type &stor, const context_config & = context_config())
+		: _storage(stor), _id(0), _n(0), _peers(NULL), _in(NULL), _spill(NULL), _nemit(0) { }
+
+	~delegate_context()
+	{
+		delete [] _in;
+		delete [] _spill;
+	}
+
+	// Let the n contexts know each other, must be called before
+	// each run.
+	static void
+	link(delegate_context *const *ctx, size_t n)
+	{
+		for (size_t i = 0; i < n; ++i) {
+			delegate_context *c = ctx[i];
+			if (c->_n != n) {
+				delete [] c->_in;
+				delete [] c->_spill;
+				c->_in	  = new ring_type [n];
+				c->_spill = new std::vector<entry_type> [n];
+			}
+			c->_id	  = i;
+			c->_n	  = n;
+			c->_peers = ctx;
+		}
+	}
+
+	void
+	combine(const key_type &key, const value_type &value)
+	{
+		size_t p = (size_t)key >> (sizeof(size_t) * 8 - NPART_BITS);
+		size_t o = p % _n;
+		if (o == _id)
+			insert(p, key, value);
+		else {
+			entry_type e(key, value);
+			if (!_peers[o]->_in[_id].push(e))
+				_spill[o].push_back(e);
+		}
+		if (++_nemit % DRAIN_INTERVAL == 0)
+			drain();
+	}
+
+	// drain what has arrived so far, the rest is collected in the
+	// merge phase
+	void
+	flush()
+	{ drain(); }
+
+	// number of partitions
+	size_t
+	npart() const
+	{ return NPART; }
+
+	// Combine partition p into the shared storage. The owner
+	// collects all pairs sent to it when merging its first
+	// partition.
+	static void
+	merge(delegate_context *const *ctx, size_t nctx, size_t p)
+	{
+		delegate_context *owner = ctx[p % nctx];
+		if (p < nctx) {
+			owner->drain();
+			for (size_t i = 0; i < nctx; ++i) {
+				std::vector<entry_type> &v = ctx[i]->_spill[p];
+				for (size_t k = 0; k < v.size(); ++k)
+					(*owner)(v[k]);
+				v.clear();
+			}
+		}
+		table_type &t = owner->_parts[p];
+		for (typename table_type::iterator it = t.begin(); it != t.end(); ++it)
+			owner->_storage.combine(it.key(), it.value());
+		t.clear();
+	}
+
+	shared_type &
+	shared()
+	{ return _storage; }
+
+	// ring sink
+	void
+	operator()(const entry_type &e)
+	{ insert((size_t)e.first >> (sizeof(size_t) * 8 - NPART_BITS), e.first, e.second); }
+
+private:
+	void
+	insert(size_t p, const key_type &key, const value_type &value)
+	{
+		table_type &t = _parts[p];
+		typename table_type::iterator it = t.find(key);
+		if (it == t.end())
+			t.insert(key, value);
+		else
+			_combiner(it.value(), value);
+	}
+
+	void
+	drain()
+	{
+		for (size_t i = 0; i < _n; ++i)
+			_in[i].drain(*this);
+	}
+
+	delegate_context(const delegate_context &) { }
+
+	delegate_context &
+	operator= (const delegate_context &)
+	{ return *this; }
+
+	shared_type	 &_storage;
+	size_t		  _id;
+	size_t		  _n;
+	delegate_context *const *_peers;
+	ring_type	 *_in;
+	std::vector<entry_type> *_spill;
+	size_t		  _nemit;
+	table_type	  _parts[NPART];
+	_Combiner	  _combiner;
+};
+
+// Job that merges the partitions of all contexts after the map
+// phase. Each worker owns a disjoint set of partitions, hence no two
+// workers ever combine the same key.
+template<typename _Context>
+class merge_job : public job
+{
+public:
+	typedef _Context context_type;
+
+	merge_job(context_type *const *ctx, size_t nctx)
+		: _ctx(ctx), _nctx(nctx) { }
+
+	void
+	operator()(size_t wid)
+	{
+		size_t npart = _nctx? _ctx[0]->npart(): 0;
+		for (size_t p = wid; p < npart; p += _nctx)
+			context_type::merge(_ctx, _nctx, p);
+	}
+
+private:
+	context_type *const *_ctx;
+	size_t		     _nctx;
+};
+
+// The per-worker contexts of a runtime. Contexts persist across
+// runs and are rebuilt only when the pool or the cache size changes.
+template<typename _Context>
+class context_array {
+public:
+	typedef _Context context_type;
+	typedef typename _Context::shared_type shared_type;
+
+	context_array() { }
+
+	~context_array()
+	{ clear(); }
+
+	// get n contexts configured with conf
+	context_type **
+	get(shared_type &shared, size_t n, const context_config &conf)
+	{
+		std::vector<shared_type *> v(n, &shared);
+		return get(&v[0], n, conf);
+	}
+
+	// get n contexts, the i-th working on shared[i]
+	context_type **
+	get(shared_type *const *shared, size_t n, const context_config &conf)
+	{
+		if (_ctxs.size() != n || !(_conf == conf) ||
+		    !std::equal(shared, shared + n, _shared.begin())) {
+			clear();
+			_conf = conf;
+			_shared.assign(shared, shared + n);
+			for (size_t i = 0; i < n; ++i)
+				_ctxs.push_back(new context_type(*shared[i], conf));
+		}
+		return &_ctxs[0];
+	}
+
+	void
+	clear()
+	{
+		for (size_t i = 0; i < _ctxs.size(); ++i)
+			delete _ctxs[i];
+		_ctxs.clear();
+	}
+
+private:
+	context_array(const context_array &) { }
+
+	context_array &
+	operator= (const context_array &)
+	{ return *this; }
+
+	context_config _conf;
+	std::vector<shared_type *>  _shared;
+	std::vector<context_type *> _ctxs;
+};
+
+}  // namespace mapcombine
+
+}  // namespace ulib
+
+#endif	/* _ULIB_MC_CONTEXT_H */
@@ -0,0 +1,106 @@
+/* The MIT License
+
+   Copyright (C) 2012 Zilong Tan (eric.zltan@gmail.com)
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   "Software"), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+
+// This file implements the batched hashing of emitted keys, see
+// emit_batch of the mappers. mix_hashes applies RAND_INT3_MIX64 to
+// an array of hash values. The mixing loop is compiled for AVX-512,
+// AVX2 and the baseline ISA, and the first call picks the widest
+// version the CPU supports, so that a batch is mixed four or eight
+// keys per instruction where the hardware allows.
+
+#ifndef _ULIB_MC_HASH_H
+#define _ULIB_MC_HASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <ulib/math_rand_prot.h>
+
+namespace ulib {
+
+namespace mapcombine {
+
+// The inner loop has a fixed trip count, which lets the compiler
+// vectorize it even with the cheap cost model of -O2.
+#define MC_MIX_HASHES_BODY(h, n)				\
+	for (; n >= 8; n -= 8, h += 8)				\
+		for (size_t i = 0; i < 8; ++i)			\
+			RAND_INT3_MIX64(h[i]);			\
+	for (size_t i = 0; i < n; ++i)				\
+		RAND_INT3_MIX64(h[i])
+
+static inline void
+mix_hashes_generic(uint64_t *h, size_t n)
+{ MC_MIX_HASHES_BODY(h, n); }
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#ifdef __clang__
+#define MC_MIX_HASHES_TARGET(isa) __attribute__((target(isa)))
+#else
+#define MC_MIX_HASHES_TARGET(isa) __attribute__((target(isa), optimize("tree-vectorize")))
+#endif
+
+MC_MIX_HASHES_TARGET("avx2")
+static inline void
+mix_hashes_avx2(uint64_t *h, size_t n)
+{ MC_MIX_HASHES_BODY(h, n); }
+
+MC_MIX_HASHES_TARGET("avx512f,avx512dq")
+static inline void
+mix_hashes_avx512(uint64_t *h, size_t n)
+{ MC_MIX_HASHES_BODY(h, n); }
+
+#undef MC_MIX_HASHES_TARGET
+#endif
+
+#undef MC_MIX_HASHES_BODY
+
+typedef void (*mix_hashes_func)(uint64_t *, size_t);
+
+static inline mix_hashes_func
+mix_hashes_select()
+{
+#if defined(__GNUC__) && defined(__x86_64__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq"))
+		return mix_hashes_avx512;
+	if (__builtin_cpu_supports("avx2"))
+		return mix_hashes_avx2;
+#endif
+	return mix_hashes_generic;
+}
+
+// Mix n hash values in place, each as RAND_INT3_MIX64 does.
+static inline void
+mix_hashes(uint64_t *h, size_t n)
+{
+	static const mix_hashes_func mix = mix_hashes_select();
+	mix(h, n);
+}
+
+}  // namespace mapcombine
+
+}  // namespace ulib
+
+#endif	/* _ULIB_MC_HASH_H */
@@ -0,0 +1,153 @@
+/* The MIT License
+
+   Copyright (C) 2012 Zilong Tan (eric.zltan@gmail.com)
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   "Software"), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+
+// This file implements the interning of string keys.
+// Keys pointing into transient buffers, e.g., words lowercased by a
+// mapper, cannot be stored as they are. key_interner turns them into
+// stable copies without a malloc per key. Every worker of the pool
+// has its own intern table and key_arena, indexed by its worker id,
+// so interning takes no lock; a string is copied once by each worker
+// that interns it. The copies live as long as the storage holding
+// them, see release().
+#ifndef _ULIB_MC_INTERN_H
+#define _ULIB_MC_INTERN_H
+
+#include <assert.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <ulib/util_class.h>
+#include <ulib/mc_alloc.h>
+#include <ulib/mc_pool.h>
+#include <ulib/mc_swiss.h>
+
+namespace ulib {
+
+namespace mapcombine {
+
+class key_interner {
+public:
+	// nworker: size of the pool whose workers call intern()
+	key_interner(size_t nworker)
+		: _nworker(nworker)
+	{ _parts = new part [nworker + 1]; }
+
+	~key_interner()
+	{ delete [] _parts; }
+
+	// The stable copy of [str, str + len). Threads running no job
+	// of the pool share one table, so they must not intern
+	// concurrently.
+	const char *
+	intern(const char *str, size_t len)
+	{
+		size_t id = worker_pool::worker_id();
+		if (id == (size_t)-1)
+			id = _nworker;
+		assert(id <= _nworker);
+		part &p = _parts[id];
+		string_ref ref(str, len);
+		table_type::iterator it = p.table.find(ref);
+		if (it != p.table.end())
+			return it.key().str;
+		char *c = (char *)p.arena.alloc(len);
+		memcpy(c, str, len);
+		p.table.insert(string_ref(c, len, ref.hash));
+		return c;
+	}
+
+	// Clear stor, whose keys were interned here, and release all
+	// copies along with it. It must not run concurrently with
+	// intern().
+	template<typename _Storage>
+	void
+	release(_Storage &stor)
+	{
+		stor.clear();
+		for (size_t i = 0; i <= _nworker; ++i) {
+			_parts[i].table.clear();
+			_parts[i].arena.clear();
+		}
+	}
+
+	// bytes held by the arenas
+	size_t
+	bytes() const
+	{
+		size_t n = 0;
+		for (size_t i = 0; i <= _nworker; ++i)
+			n += _parts[i].arena.bytes();
+		return n;
+	}
+
+private:
+	struct string_ref {
+		string_ref(const char *s, size_t n)
+			: str(s), len(n), hash(0)
+		{
+			for (size_t i = 0; i < n; ++i)
+				hash = (hash << 5) - hash + (unsigned char)s[i];
+		}
+
+		string_ref(const char *s, size_t n, size_t h)
+			: str(s), len(n), hash(h) { }
+
+		operator size_t () const
+		{ return hash; }
+
+		bool
+		operator==(const string_ref &other) const
+		{ return hash == other.hash && len == other.len && memcmp(str, other.str, len) == 0; }
+
+		const char *str;
+		size_t	    len;
+		size_t	    hash;
+	};
+
+	typedef swiss_hash_set<string_ref> table_type;
+
+	// the intern table and arena of a worker, padded so that the
+	// workers do not share cache lines
+	struct part {
+		table_type table;
+		key_arena  arena;
+		char pad[64];
+	};
+
+	key_interner(const key_interner &) { }
+
+	key_interner &
+	operator= (const key_interner &)
+	{ return *this; }
+
+	size_t _nworker;
+	part  *_parts;
+};
+
+}  // namespace mapcombine
+
+}  // namespace ulib
+
+#endif	/* _ULIB_MC_INTERN_H */
@@ -0,0 +1,140 @@
+/* The MIT License
+
+   Copyright (C) 2012 Zilong Tan (eric.zltan@gmail.com)
+
+   Permission is hereby granted, free of charge, to any person
+   obtaining a copy of this software and associated documentation
+   files (the "Software"), to deal in the Software without
+   restriction, including without limitation the rights to use, copy,
+   modify, merge, publish, distribute, sublicense, and/or sell copies
+   of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+// This file implements the NUMA helpers.
+// Linux places a page on the node of the thread that first writes
+// it. The helpers here let the workers of a pool first-touch memory
+// in contiguous per-worker ranges, the same way the schedulers deal
+// chunks, so that with a compact placement the data of a worker and
+// the chunks it is given reside on the worker's own node.
+
+#ifndef _ULIB_MC_NUMA_H
+#define _ULIB_MC_NUMA_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <new>
+#include <ulib/mc_pool.h>
+
+namespace ulib {
+
+namespace mapcombine {
+
+// Range [from, to) of n items assigned to worker wid.
+static inline void numa_range(size_t n, size_t wid, size_t nworker, size_t &from, size_t &to)
+{
+	from = wid * n / nworker;
+	to   = (wid + 1) * n / nworker;
+}
+
+// Job touching every page of a memory region. The contents are
+// preserved, only the page placement is affected.
+class first_touch_job : public job
+{
+public:
+	first_touch_job(void *addr, size_t len, size_t nworker)
+		: _addr((volatile char *)addr), _len(len), _nworker(nworker),
+		  _psize(sysconf(_SC_PAGESIZE)) { }
+
+	void
+	operator()(size_t wid)
+	{
+		size_t from, to;
+		numa_range(_len, wid, _nworker, from, to);
+		if (from == to)
+			return;
+		for (size_t off = from; off < to; off += _psize)
+			_addr[off] = _addr[off];
+		_addr[to - 1] = _addr[to - 1];
+	}
+
+private:
+	volatile char *_addr;
+	size_t	       _len;
+	size_t	       _nworker;
+	size_t	       _psize;
+};
+
+// Place a freshly allocated region over the nodes of the workers.
+static inline void first_touch(worker_pool &pool, void *addr, size_t len)
+{
+	first_touch_job job(addr, len, pool.size());
+	pool.run(job);
+}
+
+// Job constructing an array of objects in place from arg, each
+// worker constructing its own range so that the objects, and
+// whatever they allocate in their constructors, land on the nodes
+// of their workers.
+template<typename T, typename A>
+class construct_job : public job
+{
+public:
+	construct_job(T *objs, size_t n, size_t nworker, const A &arg)
+		: _objs(objs), _n(n), _nworker(nworker), _arg(arg) { }
+
+	void
+	operator()(size_t wid)
+	{
+		size_t from, to;
+		numa_range(_n, wid, _nworker, from, to);
+		for (size_t i = from; i < to; ++i)
+			new (_objs + i) T(_arg);
+	}
+
+private:
+	T      *_objs;
+	size_t	_n;
+	size_t	_nworker;
+	const A &_arg;
+};
+
+// Allocate a page-aligned array of n objects, each constructed
+// from arg by the worker owning it. Release it with numa_delete().
+template<typename T, typename A>
+static inline T *numa_new(worker_pool &pool, size_t n, const A &arg)
+{
+	void *mem;
+	if (posix_memalign(&mem, sysconf(_SC_PAGESIZE), sizeof(T) * n))
+		return NULL;
+	construct_job<T, A> job((T *)mem, n, pool.size(), arg);
+	pool.run(job);
+	return (T *)mem;
+}
+
+template<typename T>
+static inline void numa_delete(T *objs, size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+		objs[i].~T();
+	free(objs);
+}
+
+}  // namespace mapcombine
+
+}  // namespace ulib
+
+#endif	/* _ULIB_MC_NUMA_H */
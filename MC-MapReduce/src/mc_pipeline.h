@@ -26,15 +26,22 @@
 // This file implements the Proxy Synchronization Model (PSM) pipelines.
 // An array of psm queues will be created with each queue processing a
 // portion of the loads. The loads are first shuffled and then passed
-// to those queues.
+// to those queues, either one by one or in batches.
+// A flat-combining pipeline is provided as an alternative which
+// needs no queue nodes at all.
+// The inline pipeline keeps the pairs by value in its sub-tables
+// rather than the queue nodes, so that the nodes are recycled as soon
+// as they are combined.
 
 #ifndef _ULIB_MC_PIPELINE_H
 #define _ULIB_MC_PIPELINE_H
 
 #include <stdint.h>
+#include <utility>
 #include <ulib/math_bit.h>
 #include <ulib/util_class.h>
 #include <ulib/mc_typedef.h>
+#include <ulib/mc_pool.h>
 #include <ulib/mc_set.h>
 #include <ulib/mc_sync.h>
 
@@ -42,26 +49,88 @@ namespace ulib {
 
 namespace mapcombine {
 
+// Combine a datum into a set of intermediate pairs. A node is only
+// created for a new key; a datum for an existing key is combined from
+// a temporary node.
+template<typename _Set, typename _Combiner>
+static inline void psm_combine_data(_Set &set, const _Combiner &combiner,
+				    const typename _Set::key_type::data_type &d)
+{
+	typedef typename _Set::key_type key_type;
+	typename key_type::node_type node(d);
+	key_type key(&node);
+	typename _Set::iterator it = set.find(key);
+	if (it != set.end())
+		combiner(it.key(), key);
+	else {
+		key.node = new typename key_type::node_type(d);
+		set.insert(key);
+	}
+	// no memory need to be reclaimed
+	key.node = NULL;
+}
+
+// Combine n data into a set, group-prefetch style: the sub-table
+// slots of all data are prefetched before any datum is combined, so
+// that their cache misses overlap rather than stall one by one.
+template<typename _Set, typename _Data>
+static inline void psm_combine_batch(_Set &set, const _Data *d, size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+		set.prefetch((size_t)d[i]);
+	for (size_t i = 0; i < n; ++i)
+		set.combine_data(d[i]);
+}
+
+// Find the pair of a datum in a set of intermediate pairs.
+template<typename _Set>
+static inline typename _Set::iterator
+psm_find_data(_Set &set, const typename _Set::key_type::data_type &d)
+{
+	typedef typename _Set::key_type key_type;
+	typename key_type::node_type node(d);
+	key_type key(&node);
+	typename _Set::iterator it = set.find(key);
+	// no memory need to be reclaimed
+	key.node = NULL;
+	return it;
+}
+
 template< typename _Node, typename _Combiner = additive_combiner<_Node> >
 class psm_pipeline : public multi_hash_set<_Node, ulib_except, _Combiner>
 {
 public:
 	typedef _Node node_type;
 	typedef typename _Node::data_type data_type;
+	typedef psm_batch<data_type> batch_type;
 	typedef multi_hash_set<_Node, ulib_except, _Combiner> set_type;
+	// a dequeued node, see psm_process_fas
+	typedef _Node node_ref;
 
 	psm_pipeline(size_t min)
-		: set_type(min)
+		: set_type(min), _limit(0)
 	{
 		assert(min);
 		_mask = set_type::bucket_count() - 1;
 		_queues = new psm_queue<data_type> [_mask + 1];
+		_batches = new psm_batch_queue<data_type> [_mask + 1];
+	}
+
+	// NUMA mode, see multi_hash_set
+	psm_pipeline(size_t min, worker_pool &pool, size_t nkey)
+		: set_type(min, pool, nkey), _limit(0)
+	{
+		assert(min);
+		_mask = set_type::bucket_count() - 1;
+		_queues = new psm_queue<data_type> [_mask + 1];
+		_batches = new psm_batch_queue<data_type> [_mask + 1];
 	}
 
 	virtual
 	~psm_pipeline()
 	{
 		delete [] _queues;
+		delete [] _batches;
 		// Note that the following is necessary because
 		// open hashing does not destruct its elements;
 		// otherwise it can be ignored.
@@ -75,7 +144,60 @@ public:
 	// greatly affect the performance.
 	virtual void
 	process(const data_type &d)
-	{ psm_process_fas(_queues[(size_t)d & _mask], d, *this); }
+	{ psm_process_fas(_queues[(size_t)d & _mask], d, *this, _limit); }
+
+	// process a datum constructed in its queue node, which the
+	// pipeline takes over
+	void
+	process_node(psm_node<data_type> *node)
+	{ psm_process_fas(_queues[(size_t)node->data & _mask], node, *this, _limit); }
+
+	// process the datum constructed from key and value right in
+	// its queue node
+#if __cplusplus >= 201103L
+	template<typename _Key, typename _Val>
+	void
+	emplace(_Key &&key, _Val &&value)
+	{ process_node(new psm_node<data_type>(std::forward<_Key>(key), std::forward<_Val>(value))); }
+#else
+	template<typename _Key, typename _Val>
+	void
+	emplace(const _Key &key, const _Val &value)
+	{ process_node(new psm_node<data_type>(key, value)); }
+#endif
+
+	// Process a batch of data which all belong to queue qid, the
+	// pipeline takes the ownership of the batch. The data of a
+	// queue must be delivered either one by one or in batches
+	// throughout a run, because the two are proxied separately.
+	void
+	process_batch(size_t qid, batch_type *b)
+	{ psm_process_batch(_batches[qid], b, *this, _limit); }
+
+	// the queue that processes d
+	size_t
+	queue_of(const data_type &d) const
+	{ return (size_t)d & _mask; }
+
+	// combine a datum of a batch
+	void
+	combine_data(const data_type &d)
+	{ psm_combine_data(*this, _combiner, d); }
+
+	void
+	combine_batch(const data_type *d, size_t n)
+	{ psm_combine_batch(*this, d, n); }
+
+	typename set_type::iterator
+	find_data(const data_type &d)
+	{ return psm_find_data(*this, d); }
+
+	// Bound the work of a proxy to limit items, after which it
+	// hands the queue over to an arriving thread if there is one;
+	// zero, the default, means unbounded.
+	void
+	set_proxy_limit(size_t limit)
+	{ _limit = limit; }
 
 	// The pipeline capacity is the number of queues.
 	virtual size_t
@@ -85,6 +207,9 @@ public:
 protected:
 	size_t _mask;
 	psm_queue<data_type> *_queues;
+	psm_batch_queue<data_type> *_batches;
+	_Combiner _combiner;
+	size_t _limit;
 
 private:
 	psm_pipeline(const psm_pipeline &) { }
@@ -94,6 +219,422 @@ private:
 	{ return *this; }
 };
 
+// Job that merges a number of pipelines into one, all of the same
+// capacity. Each worker merges a disjoint set of partitions, hence
+// needs no synchronization, and the source pipelines end up empty.
+template<typename _Pipeline>
+class pipeline_merge_job : public job
+{
+public:
+	typedef _Pipeline pipeline_type;
+	typedef typename _Pipeline::set_type set_type;
+
+	pipeline_merge_job(pipeline_type &to, pipeline_type *const *from, size_t nfrom,
+			   size_t nworker)
+		: _to(to), _from(from), _nfrom(nfrom), _nworker(nworker) { }
+
+	void
+	operator()(size_t wid)
+	{
+		for (size_t q = wid; q < _to.pipeline_capacity(); q += _nworker) {
+			for (size_t i = 0; i < _nfrom; ++i) {
+				typename set_type::iterator end = _from[i]->end(q);
+				for (typename set_type::iterator it = _from[i]->begin(q);
+				     it != end; ++it) {
+					// take over the node, see psm_pipeline
+					typename set_type::key_type key = it.key();
+					_to.combine(key);
+				}
+				_from[i]->clear(q);
+			}
+		}
+	}
+
+private:
+	pipeline_type	     &_to;
+	pipeline_type *const *_from;
+	size_t		      _nfrom;
+	size_t		      _nworker;
+};
+
+// Flat-combining pipeline.
+// It is a drop-in replacement of psm_pipeline. Each sub-table has a
+// lock and a publication array with one request slot per worker of
+// the pool feeding the pipeline, indexed by worker_pool::worker_id().
+// A worker publishes its data in its slot and tries the lock; the
+// holder of the lock combines all pending requests of the sub-table
+// in one pass, so the requests cost no allocation and the sub-table
+// stays in the cache of the combiner. Other threads, and workers
+// beyond the publication array, combine under the lock by
+// themselves. The arrays are sized by attach(), which psm_runtime
+// calls before each run; the pipeline must not be fed by two pools
+// at once.
+template< typename _Node, typename _Combiner = additive_combiner<_Node> >
+class fc_pipeline : public multi_hash_set<_Node, ulib_except, _Combiner>
+{
+public:
+	typedef _Node node_type;
+	typedef typename _Node::data_type data_type;
+	typedef psm_batch<data_type> batch_type;
+	typedef multi_hash_set<_Node, ulib_except, _Combiner> set_type;
+
+	fc_pipeline(size_t min)
+		: set_type(min)
+	{ init(); }
+
+	// NUMA mode, see multi_hash_set
+	fc_pipeline(size_t min, worker_pool &pool, size_t nkey)
+		: set_type(min, pool, nkey)
+	{
+		init();
+		attach(pool);
+	}
+
+	virtual
+	~fc_pipeline()
+	{
+		delete [] _locks;
+		delete [] _slots;
+		// see psm_pipeline
+		for (typename set_type::iterator it = this->begin();
+		     it != this->end(); ++it)
+			typename set_type::key_type key = it.key();
+	}
+
+	virtual void
+	process(const data_type &d)
+	{ publish(queue_of(d), &d, 1); }
+
+	// the datum is published from the stack, since the combiner
+	// of its sub-table copies it
+#if __cplusplus >= 201103L
+	template<typename _Key, typename _Val>
+	void
+	emplace(_Key &&key, _Val &&value)
+	{
+		data_type d(std::forward<_Key>(key), std::forward<_Val>(value));
+		publish(queue_of(d), &d, 1);
+	}
+#else
+	template<typename _Key, typename _Val>
+	void
+	emplace(const _Key &key, const _Val &value)
+	{
+		data_type d(key, value);
+		publish(queue_of(d), &d, 1);
+	}
+#endif
+
+	// process a batch of data which all belong to sub-table qid,
+	// the pipeline takes the ownership of the batch
+	void
+	process_batch(size_t qid, batch_type *b)
+	{
+		publish(qid, b->data(), b->size);
+		delete b;
+	}
+
+	// the sub-table that combines d
+	size_t
+	queue_of(const data_type &d) const
+	{ return (size_t)d & _mask; }
+
+	void
+	combine_data(const data_type &d)
+	{ psm_combine_data(*this, _combiner, d); }
+
+	void
+	combine_batch(const data_type *d, size_t n)
+	{ psm_combine_batch(*this, d, n); }
+
+	typename set_type::iterator
+	find_data(const data_type &d)
+	{ return psm_find_data(*this, d); }
+
+	// The pipeline capacity is the number of sub-tables.
+	virtual size_t
+	pipeline_capacity() const
+	{ return _mask + 1; }
+
+	// Size the publication arrays for the workers of pool. It must
+	// not be called while the pipeline is being fed.
+	void
+	attach(const worker_pool &pool)
+	{
+		if (pool.size() <= _nthread)
+			return;
+		delete [] _slots;
+		_nthread = pool.size();
+		_slots	 = new slot [(_mask + 1) * _nthread];
+	}
+
+private:
+	struct lock {
+		lock() : held(0) { }
+		volatile int64_t held;
+		char pad[64 - sizeof(int64_t)];
+	};
+
+	// request slot, being NULL once served
+	struct slot {
+		slot() : req(NULL), nreq(0) { }
+		const data_type * volatile req;
+		size_t nreq;
+		char pad[64 - sizeof(void *) - sizeof(size_t)];
+	};
+
+	void
+	init()
+	{
+		_nthread = 0;
+		_mask	 = set_type::bucket_count() - 1;
+		_locks	 = new lock [_mask + 1];
+		_slots	 = NULL;
+	}
+
+	void
+	publish(size_t qid, const data_type *req, size_t nreq)
+	{
+		lock &l = _locks[qid];
+		size_t tid = worker_pool::worker_id();
+		if (tid >= _nthread) {
+			acquire(l);
+			combine_batch(req, nreq);
+			atomic_fetchstore64(&l.held, 0);
+			return;
+		}
+		slot &s = _slots[qid * _nthread + tid];
+		s.nreq = nreq;
+		atomic_barrier();
+		s.req  = req;
+		for (;;) {
+			if (l.held == 0 && atomic_cmpswp64(&l.held, 0, 1) == 0) {
+				// our own request is pending, hence served
+				slot *pub = _slots + qid * _nthread;
+				for (size_t t = 0; t < _nthread; ++t) {
+					const data_type *r = pub[t].req;
+					if (r == NULL)
+						continue;
+					combine_batch(r, pub[t].nreq);
+					atomic_barrier();
+					pub[t].req = NULL;
+				}
+				atomic_fetchstore64(&l.held, 0);
+				return;
+			}
+			if (s.req == NULL)
+				return;
+			atomic_cpu_relax();
+		}
+	}
+
+	static void
+	acquire(lock &l)
+	{
+		psm_backoff backoff;
+		while (l.held || atomic_cmpswp64(&l.held, 0, 1))
+			backoff();
+	}
+
+	fc_pipeline(const fc_pipeline &) { }
+
+	fc_pipeline &
+	operator= (const fc_pipeline &)
+	{ return *this; }
+
+	size_t	  _mask;
+	size_t	  _nthread;
+	lock	 *_locks;
+	slot	 *_slots;
+	_Combiner _combiner;
+};
+
+// Prepare a pipeline to be fed by the workers of pool, see
+// fc_pipeline::attach(). The other pipelines need nothing.
+template<typename _Pipeline>
+static inline void pipeline_attach(_Pipeline &, const worker_pool &)
+{ }
+
+template<typename _Node, typename _Combiner>
+static inline void pipeline_attach(fc_pipeline<_Node, _Combiner> &pl, const worker_pool &pool)
+{ pl.attach(pool); }
+
+// Intermediate pair held by value, see inline_pipeline.
+template<typename _Data>
+struct inline_pair {
+	typedef typename _Data::first_type  key_type;
+	typedef typename _Data::second_type value_type;
+
+	inline_pair(const _Data &d)
+		: data(d) { }
+
+	key_type &
+	key()
+	{ return data.first; }
+
+	const key_type &
+	key() const
+	{ return data.first; }
+
+	value_type &
+	value()
+	{ return data.second; }
+
+	const value_type &
+	value() const
+	{ return data.second; }
+
+	// the cached hash value of the datum
+	operator size_t () const
+	{ return (size_t)data; }
+
+	bool
+	operator==(const inline_pair &other) const
+	{ return (size_t)data == (size_t)other.data && data.first == other.data.first; }
+
+	_Data data;
+};
+
+// Inline PSM pipeline.
+// It is a drop-in replacement of psm_pipeline whose sub-tables hold
+// the pairs themselves, including the cached hash, instead of
+// pointers to the queue nodes. A pair is copied into its slot when
+// its key is first seen and combined in place afterwards, so every
+// queue node is recycled right after it is combined and the probes
+// never leave the table. Note that the pairs are not destructed when
+// a sub-table is cleared, as with open hashing in general.
+template< typename _Node, typename _Combiner = additive_combiner<_Node> >
+class inline_pipeline :
+		public multi_hash_set<inline_pair<typename _Node::data_type>, ulib_except, _Combiner>
+{
+public:
+	typedef _Node node_type;
+	typedef typename _Node::data_type data_type;
+	typedef psm_batch<data_type> batch_type;
+	typedef inline_pair<data_type> pair_type;
+	typedef multi_hash_set<pair_type, ulib_except, _Combiner> set_type;
+
+	// a dequeued node, which is reclaimed once its datum is
+	// combined, see psm_process_fas
+	class node_ref {
+	public:
+		node_ref(psm_node<data_type> *n)
+			: node(n) { }
+
+		~node_ref()
+		{ delete node; }
+
+		psm_node<data_type> *node;
+
+	private:
+		node_ref(const node_ref &) { }
+
+		node_ref &
+		operator= (const node_ref &)
+		{ return *this; }
+	};
+
+	inline_pipeline(size_t min)
+		: set_type(min), _limit(0)
+	{ init(); }
+
+	// NUMA mode, see multi_hash_set
+	inline_pipeline(size_t min, worker_pool &pool, size_t nkey)
+		: set_type(min, pool, nkey), _limit(0)
+	{ init(); }
+
+	virtual
+	~inline_pipeline()
+	{
+		delete [] _queues;
+		delete [] _batches;
+		for (typename set_type::iterator it = this->begin();
+		     it != this->end(); ++it)
+			it.key().~pair_type();
+	}
+
+	using set_type::combine;
+
+	void
+	combine(const node_ref &ref)
+	{ combine_data(ref.node->data); }
+
+	virtual void
+	process(const data_type &d)
+	{ psm_process_fas(_queues[(size_t)d & _mask], d, *this, _limit); }
+
+	// process a datum constructed in its queue node, which the
+	// pipeline takes over
+	void
+	process_node(psm_node<data_type> *node)
+	{ psm_process_fas(_queues[(size_t)node->data & _mask], node, *this, _limit); }
+
+	// process the datum constructed from key and value right in
+	// its queue node
+#if __cplusplus >= 201103L
+	template<typename _Key, typename _Val>
+	void
+	emplace(_Key &&key, _Val &&value)
+	{ process_node(new psm_node<data_type>(std::forward<_Key>(key), std::forward<_Val>(value))); }
+#else
+	template<typename _Key, typename _Val>
+	void
+	emplace(const _Key &key, const _Val &value)
+	{ process_node(new psm_node<data_type>(key, value)); }
+#endif
+
+	// see psm_pipeline
+	void
+	process_batch(size_t qid, batch_type *b)
+	{ psm_process_batch(_batches[qid], b, *this, _limit); }
+
+	size_t
+	queue_of(const data_type &d) const
+	{ return (size_t)d & _mask; }
+
+	void
+	combine_data(const data_type &d)
+	{ set_type::combine(pair_type(d)); }
+
+	void
+	combine_batch(const data_type *d, size_t n)
+	{ psm_combine_batch(*this, d, n); }
+
+	typename set_type::iterator
+	find_data(const data_type &d)
+	{ return this->find(pair_type(d)); }
+
+	// see psm_pipeline
+	void
+	set_proxy_limit(size_t limit)
+	{ _limit = limit; }
+
+	// The pipeline capacity is the number of queues.
+	virtual size_t
+	pipeline_capacity() const
+	{ return _mask + 1; }
+
+private:
+	void
+	init()
+	{
+		_mask	 = set_type::bucket_count() - 1;
+		_queues	 = new psm_queue<data_type> [_mask + 1];
+		_batches = new psm_batch_queue<data_type> [_mask + 1];
+	}
+
+	inline_pipeline(const inline_pipeline &) { }
+
+	inline_pipeline &
+	operator= (const inline_pipeline &)
+	{ return *this; }
+
+	size_t _mask;
+	psm_queue<data_type> *_queues;
+	psm_batch_queue<data_type> *_batches;
+	size_t _limit;
+};
+
 }  // namespace mapcombine
 
 }  // namespace ulib
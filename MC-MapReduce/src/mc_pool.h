@@ -0,0 +1,272 @@
+/* The MIT License
+
+   Copyright (C) 2012 Zilong Tan (eric.zltan@gmail.com)
+
+   Permission is hereby granted, free of charge, to any person
+   obtaining a copy of this software and associated documentation
+   files (the "Software"), to deal in the Software without
+   restriction, including without limitation the rights to use, copy,
+   modify, merge, publish, distribute, sublicense, and/or sell copies
+   of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+// This file implements a persistent worker pool.
+// The pool owns a fixed set of pinned worker threads which are
+// created once and reused by every run. A run publishes a job to the
+// workers, executes its own share of the job in the calling thread
+// and then waits on a spinning barrier until all the workers are
+// done. The calling thread is pinned for the duration of the run
+// and gets its original affinity back afterwards. Idle workers spin
+// for a while before going to sleep, so that back-to-back runs,
+// e.g., the iterations of k-means, do not pay for thread creation,
+// pinning and joining. Workers are pinned according to a
+// cpu_placement, see mc_topology.h.
+
+#ifndef _ULIB_MC_POOL_H
+#define _ULIB_MC_POOL_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <pthread.h>
+
+#include <stdint.h>
+#include <vector>
+#include <ulib/util_log.h>
+#include <ulib/os_thread.h>
+#include <ulib/os_atomic_intel64.h>
+#include <ulib/mc_topology.h>
+
+namespace ulib {
+
+namespace mapcombine {
+
+// The job prototype.
+// A job is executed once by every worker of a pool. Worker ids are
+// in [0, pool size), with the calling thread being worker 0.
+struct job {
+	virtual
+	~job() { }
+
+	virtual void
+	operator()(size_t wid) = 0;
+};
+
+class worker_pool {
+public:
+	// nworker: number of workers including the calling thread,
+	//	    zero means one worker per usable processor; more
+	//	    workers than processors oversubscribe the machine,
+	//	    which helps when mappers block, e.g., on page faults
+	// place: processors on which the workers are pinned
+	// nspin: number of times an idle worker polls for a new job
+	//	  before going to sleep
+	worker_pool(size_t nworker = 0, const cpu_placement &place = cpu_placement(),
+		    size_t nspin = 0x10000)
+		: _place(place), _nspin(nspin), _gen(0), _pending(0), _stop(false), _job(NULL)
+	{
+		if (nworker == 0)
+			nworker = place.size();
+		_nworker = nworker;
+		pthread_mutex_init(&_mutex, NULL);
+		pthread_mutex_init(&_run_mutex, NULL);
+		pthread_cond_init(&_cond, NULL);
+		// worker 0 is the calling thread, which is pinned to
+		// processor place[0] only while it runs a job
+		for (size_t w = 1; w < _nworker; ++w) {
+			_workers.push_back(new worker(*this, w, place[w]));
+			_workers.back()->start();
+		}
+	}
+
+	virtual
+	~worker_pool()
+	{
+		pthread_mutex_lock(&_mutex);
+		_stop = true;
+		++_gen;
+		pthread_mutex_unlock(&_mutex);
+		pthread_cond_broadcast(&_cond);
+		for (size_t i = 0; i < _workers.size(); ++i)
+			delete _workers[i];
+		pthread_cond_destroy(&_cond);
+		pthread_mutex_destroy(&_run_mutex);
+		pthread_mutex_destroy(&_mutex);
+	}
+
+	// Execute the job on all workers and return when every worker
+	// finishes. Runs from different threads are serialized, so a
+	// pool can be shared by several runtimes.
+	void
+	run(job &j)
+	{
+		pthread_mutex_lock(&_run_mutex);
+		cpu_set_t saved;
+		bool pinned = pin_caller(&saved);
+		size_t caller = current();
+		current() = 0;
+		if (_nworker > 1) {
+			_job = &j;
+			_pending = _nworker - 1;
+			pthread_mutex_lock(&_mutex);
+			++_gen;
+			pthread_mutex_unlock(&_mutex);
+			pthread_cond_broadcast(&_cond);
+		}
+		j(0);
+		while (_pending)
+			atomic_cpu_relax();
+		current() = caller;
+		if (pinned && pthread_setaffinity_np(pthread_self(), sizeof(saved), &saved))
+			ULIB_WARNING("cannot restore the affinity of the calling thread");
+		pthread_mutex_unlock(&_run_mutex);
+	}
+
+	// Number of workers, including the calling thread.
+	size_t
+	size() const
+	{ return _nworker; }
+
+	const cpu_placement &
+	placement() const
+	{ return _place; }
+
+	// Id of the calling thread among the workers of the pool whose
+	// job it runs, or (size_t)-1 if the thread runs no job.
+	static size_t
+	worker_id()
+	{ return current(); }
+
+private:
+	class worker : public thread {
+	public:
+		worker(worker_pool &pool, size_t wid, int cpuid)
+			: _pool(pool), _wid(wid), _cpuid(cpuid) { }
+
+		virtual
+		~worker()
+		{ stop_and_join(); }
+
+	private:
+		int
+		setup()
+		{
+			// each worker is assigned to a unique processor
+			cpu_set_t cpu_set;
+			CPU_ZERO(&cpu_set);
+			CPU_SET(_cpuid, &cpu_set);
+			int ret = pthread_setaffinity_np(thread::_tid, sizeof(cpu_set), &cpu_set);
+			if (ret)
+				ULIB_WARNING("cannot pin worker %zu to processor %d, error=%d",
+					     _wid, _cpuid, ret);
+			// an unpinned worker still serves jobs, failing
+			// here would leave run() waiting on it forever
+			return 0;
+		}
+
+		int
+		run()
+		{
+			_pool.serve(_wid);
+			return 0;
+		}
+
+		worker_pool &_pool;
+		size_t	     _wid;
+		int	     _cpuid;
+	};
+
+	static size_t &
+	current()
+	{
+		static __thread size_t wid = (size_t)-1;
+		return wid;
+	}
+
+	// pin the calling thread to the processor of worker 0, saving
+	// its affinity in saved; return false if nothing was changed
+	bool
+	pin_caller(cpu_set_t *saved)
+	{
+		pthread_t self = pthread_self();
+		if (pthread_getaffinity_np(self, sizeof(*saved), saved))
+			return false;
+		cpu_set_t cpu_set;
+		CPU_ZERO(&cpu_set);
+		CPU_SET(_place[0], &cpu_set);
+		int ret = pthread_setaffinity_np(self, sizeof(cpu_set), &cpu_set);
+		if (ret) {
+			ULIB_WARNING("cannot pin the calling thread to processor %d, error=%d",
+				     _place[0], ret);
+			return false;
+		}
+		return true;
+	}
+
+	// wait until the generation moves past gen
+	uint64_t
+	wait(uint64_t gen)
+	{
+		for (size_t i = 0; i < _nspin; ++i) {
+			if (_gen != gen)
+				return _gen;
+			atomic_cpu_relax();
+		}
+		pthread_mutex_lock(&_mutex);
+		while (_gen == gen)
+			pthread_cond_wait(&_cond, &_mutex);
+		gen = _gen;
+		pthread_mutex_unlock(&_mutex);
+		return gen;
+	}
+
+	void
+	serve(size_t wid)
+	{
+		uint64_t gen = 0;
+		current() = wid;
+		for (;;) {
+			gen = wait(gen);
+			if (_stop)
+				break;
+			(*_job)(wid);
+			atomic_dec64(&_pending);
+		}
+	}
+
+	worker_pool(const worker_pool &) { }
+
+	worker_pool &
+	operator= (const worker_pool &)
+	{ return *this; }
+
+	cpu_placement	      _place;
+	size_t		      _nworker;
+	size_t		      _nspin;
+	volatile uint64_t     _gen;
+	volatile int64_t      _pending;
+	volatile bool	      _stop;
+	job * volatile	      _job;
+	pthread_mutex_t	      _mutex;
+	pthread_mutex_t	      _run_mutex;
+	pthread_cond_t	      _cond;
+	std::vector<worker *> _workers;
+};
+
+}  // namespace mapcombine
+
+}  // namespace ulib
+
+#endif	/* _ULIB_MC_POOL_H */
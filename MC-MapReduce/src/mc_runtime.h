@@ -28,14 +28,21 @@
 
 #include <stdint.h>
 #include <unistd.h>
+#include <vector>
+#include <algorithm>
 #include <ulib/util_class.h>
 #include <ulib/math_rand_prot.h>
 #include <ulib/hash_chain_r.h>
 #include <ulib/hash_multi_r.h>
 #include <ulib/mc_splitter.h>
 #include <ulib/mc_typedef.h>
+#include <ulib/mc_pool.h>
 #include <ulib/mc_task.h>
+#include <ulib/mc_sched.h>
+#include <ulib/mc_context.h>
 #include <ulib/mc_pipeline.h>
+#include <ulib/mc_storage.h>
+#include <ulib/mc_hash.h>
 
 namespace ulib {
 
@@ -47,7 +54,8 @@ template<
 	typename _Val,
 	template<typename _Pipeline> class _Mapper,
 	typename _Partition,
-	typename _Combiner = additive_combiner<_Val> >
+	typename _Combiner = additive_combiner<_Val>,
+	template<typename _BNode, typename _BCombiner> class _Backend = psm_pipeline>
 class psm_runtime {
 public:
 	typedef _Splitter  splitter_type;
@@ -69,6 +77,32 @@ public:
 				RAND_INT3_MIX64(hash);
 			}
 
+#if __cplusplus >= 201103L
+			data_type(_Key &&key, _Val &&val)
+				: std::pair<_Key, _Val>(std::move(key), std::move(val))
+			{
+				partition_type part;
+				hash = part(this->first);
+				RAND_INT3_MIX64(hash);
+			}
+#endif
+
+			// h: the hash value of key given by
+			// hash_batch
+			data_type(const _Key &key, const _Val &val, size_t h)
+				: std::pair<_Key, _Val>(key, val), hash(h) { }
+
+			// the hash values of n keys, the same as the
+			// first constructor computes
+			static void
+			hash_batch(const _Key *keys, uint64_t *h, size_t n)
+			{
+				partition_type part;
+				for (size_t i = 0; i < n; ++i)
+					h[i] = part(keys[i]);
+				mix_hashes(h, n);
+			}
+
 			operator size_t () const
 			{ return hash; }
 
@@ -140,73 +174,204 @@ public:
 		operator()(interm_pair &sum, const interm_pair &value) const
 		{ combiner(sum.value(), value.value());	}
 
+		// likewise for the pairs of inline_pipeline
+		template<typename _Data>
+		void
+		operator()(inline_pair<_Data> &sum, const inline_pair<_Data> &value) const
+		{ combiner(sum.value(), value.value());	}
+
 		combiner_type combiner;
 	};
 
-	typedef psm_pipeline<interm_pair, interm_value_combiner> pipeline_type;
+	typedef _Backend<interm_pair, interm_value_combiner> pipeline_type;
+
+	typedef psm_context<pipeline_type, combiner_type> context_type;
 
-	typedef _Mapper<pipeline_type> mapper_type;
+	typedef _Mapper<context_type> mapper_type;
 
-	typedef task<typename splitter_type::chunk_type, pipeline_type, mapper_type> task_type;
+	typedef task<typename splitter_type::chunk_type, context_type, mapper_type> task_type;
 
-	psm_runtime(splitter_type &sp, pipeline_type &pl)
-		: _splitter(sp), _pipeline(pl)
-	{ _ncpu = sysconf(_SC_NPROCESSORS_ONLN); }
+	// nworker: size of the private worker pool, zero means one
+	//	    worker per usable processor, see worker_pool
+	psm_runtime(splitter_type &sp, pipeline_type &pl, size_t nworker = 0)
+		: _splitter(sp), _pipeline(pl),
+		  _pool(new worker_pool(nworker)), _own_pool(true),
+		  _policy(schedule_queue), _grain(1), _socket(false) { }
+
+	// share the worker pool with other runtimes
+	psm_runtime(splitter_type &sp, pipeline_type &pl, worker_pool &pool)
+		: _splitter(sp), _pipeline(pl),
+		  _pool(&pool), _own_pool(false),
+		  _policy(schedule_queue), _grain(1), _socket(false) { }
+
+	virtual
+	~psm_runtime()
+	{
+		if (_own_pool)
+			delete _pool;
+		for (size_t i = 0; i < _levels.size(); ++i)
+			delete _levels[i];
+	}
 
 	void
 	run(size_t ntask = 0)
+	{ run(ntask, no_prototype()); }
+
+	// Run with a mapper prototype, which every task copies, e.g.,
+	// the function object of func_mapper.
+	template<typename _Proto>
+	void
+	run(size_t ntask, const _Proto &proto)
 	{
-		if (ntask == 0)
-			ntask = _ncpu;
-		task_type *tasks[ntask];
-		int ret = _splitter.split(ntask);
-		if (ret) {
-			ULIB_FATAL("split failed with nchunk=%zu", ntask);
+		if (!_socket) {
+			pipeline_attach(_pipeline, *_pool);
+			schedule<task_type>(*_pool, _splitter, _ctxs.get(_pipeline, _pool->size(), _config),
+					    ntask, _policy, _grain, proto);
 			return;
 		}
-		int t = 0;
-		for (; t < (int)_splitter.size(); ++t) {
-			if (t >= _ncpu) {
-				ULIB_FATAL("too many chunks, no greater than %d expected", _ncpu);
-				while (--t >= 0)
-					delete tasks[t];
-				return;
-			}
-			tasks[t] = new task_type(t, _splitter.chunk(t), _pipeline);
-			tasks[t]->start();
-		}
-		for (int i = 0; i < t; ++i)
-			delete tasks[i];
+		std::vector<pipeline_type *> shared = socket_levels();
+		for (size_t i = 0; i < _levels.size(); ++i)
+			pipeline_attach(*_levels[i], *_pool);
+		schedule<task_type>(*_pool, _splitter, _ctxs.get(&shared[0], shared.size(), _config),
+				    ntask, _policy, _grain, proto);
+		pipeline_merge_job<pipeline_type> job(_pipeline, &_levels[0], _levels.size(), _pool->size());
+		_pool->run(job);
+	}
+
+	// Select the chunk scheduling policy.
+	//     grain: chunks per task for schedule_steal
+	void
+	set_schedule(schedule_policy policy, size_t grain = 16)
+	{
+		_policy = policy;
+		_grain	= grain;
 	}
 
+	// Set the number of slots of the per-worker combining cache,
+	// zero, the default, disables the cache.
+	void
+	set_cache(size_t nslot)
+	{ _config.cache = nslot; }
+
+	// Enable or disable batched delivery to the PSM queues.
+	void
+	set_batch(bool batch)
+	{ _config.batch = batch; }
+
+	// Enable or disable per-socket combining. The workers of each
+	// socket then combine into a socket-private pipeline, so that
+	// the queues and sub-tables are only shared within the socket,
+	// and the socket pipelines are merged into the pipeline at the
+	// end of each run.
+	void
+	set_socket_combining(bool socket)
+	{ _socket = socket; }
+
+	worker_pool &
+	pool()
+	{ return *_pool; }
+
 	typename pipeline_type::iterator
 	find(const key_type &key)
 	{
 		typename interm_pair::data_type data(key, value_type());
-		typename interm_pair::node_type node(data);
-		interm_pair pair(&node);
-		typename pipeline_type::iterator it = _pipeline.find(pair);
-		// no memory need to be reclaimed
-		pair.node = NULL;
-		return it;
+		return _pipeline.find_data(data);
 	}
 
 	typename pipeline_type::const_iterator
 	find(const key_type &key) const
 	{
 		typename interm_pair::data_type data(key, value_type());
-		typename interm_pair::node_type node(data);
-		interm_pair pair(&node);
-		typename pipeline_type::const_iterator it = _pipeline.find(pair);
-		// no memory need to be reclaimed
-		pair.node = NULL;
-		return it;
+		return _pipeline.find_data(data);
 	}
 
 private:
-	splitter_type &_splitter;
-	pipeline_type &_pipeline;
-	int _ncpu;
+	// the pipeline of the socket of each worker
+	std::vector<pipeline_type *>
+	socket_levels()
+	{
+		std::vector<int> packages;
+		std::vector<pipeline_type *> shared;
+		for (size_t w = 0; w < _pool->size(); ++w) {
+			int pkg = _pool->placement().info(w).package;
+			size_t i = std::find(packages.begin(), packages.end(), pkg) - packages.begin();
+			if (i == packages.size())
+				packages.push_back(pkg);
+			if (i == _levels.size()) {
+				_levels.push_back(new pipeline_type(_pipeline.pipeline_capacity()));
+				_levels.back()->set_split(_pipeline.split_limit());
+			}
+			shared.push_back(_levels[i]);
+		}
+		return shared;
+	}
+
+	psm_runtime(const psm_runtime &) { }
+
+	psm_runtime &
+	operator= (const psm_runtime &)
+	{ return *this; }
+
+	splitter_type	&_splitter;
+	pipeline_type	&_pipeline;
+	worker_pool	*_pool;
+	bool		 _own_pool;
+	schedule_policy	 _policy;
+	size_t		 _grain;
+	context_config	 _config;
+	context_array<context_type> _ctxs;
+	bool		 _socket;
+	std::vector<pipeline_type *> _levels;
+};
+
+// PSM runtime over the flat-combining pipeline.
+template<
+	typename _Splitter,
+	typename _Key,
+	typename _Val,
+	template<typename _Pipeline> class _Mapper,
+	typename _Partition,
+	typename _Combiner = additive_combiner<_Val> >
+class fc_runtime :
+		public psm_runtime<_Splitter, _Key, _Val, _Mapper,
+				   _Partition, _Combiner, fc_pipeline> {
+public:
+	typedef psm_runtime<_Splitter, _Key, _Val, _Mapper, _Partition, _Combiner, fc_pipeline> runtime_type;
+
+	fc_runtime(typename runtime_type::splitter_type &sp,
+		   typename runtime_type::pipeline_type &pl,
+		   size_t nworker = 0)
+		: runtime_type(sp, pl, nworker) { }
+
+	fc_runtime(typename runtime_type::splitter_type &sp,
+		   typename runtime_type::pipeline_type &pl,
+		   worker_pool &pool)
+		: runtime_type(sp, pl, pool) { }
+};
+
+// PSM runtime over the inline pipeline.
+template<
+	typename _Splitter,
+	typename _Key,
+	typename _Val,
+	template<typename _Pipeline> class _Mapper,
+	typename _Partition,
+	typename _Combiner = additive_combiner<_Val> >
+class inline_runtime :
+		public psm_runtime<_Splitter, _Key, _Val, _Mapper,
+				   _Partition, _Combiner, inline_pipeline> {
+public:
+	typedef psm_runtime<_Splitter, _Key, _Val, _Mapper, _Partition, _Combiner, inline_pipeline> runtime_type;
+
+	inline_runtime(typename runtime_type::splitter_type &sp,
+		       typename runtime_type::pipeline_type &pl,
+		       size_t nworker = 0)
+		: runtime_type(sp, pl, nworker) { }
+
+	inline_runtime(typename runtime_type::splitter_type &sp,
+		       typename runtime_type::pipeline_type &pl,
+		       worker_pool &pool)
+		: runtime_type(sp, pl, pool) { }
 };
 
 // General mapcombine runtime and the variants.
@@ -218,7 +383,8 @@ template<
 	typename _Partition,
 	typename _Combiner = additive_combiner<_Val>,
 	template<typename _SKey, typename _SVal, typename _Except,
-		 typename _Combiner, typename _RegionLock> class _Storage = multi_hash_map>
+		 typename _SCombiner, typename _RegionLock> class _Storage = multi_hash_map,
+	template<typename _CStorage, typename _CCombiner> class _Context = mc_context>
 class mc_runtime {
 public:
 	typedef _Splitter  splitter_type;
@@ -234,7 +400,39 @@ public:
 		{
 			partition_type part;
 			uint64_t h = part(key);
-			_hash = RAND_INT3_MIX64(h);
+			// storages indexed by the partition value
+			// take it as is
+			if (storage_hashed<_Storage>::value)
+				RAND_INT3_MIX64(h);
+			_hash = h;
+		}
+
+#if __cplusplus >= 201103L
+		storage_key(key_type &&key)
+			: _key(std::move(key))
+		{
+			partition_type part;
+			uint64_t h = part(_key);
+			if (storage_hashed<_Storage>::value)
+				RAND_INT3_MIX64(h);
+			_hash = h;
+		}
+#endif
+
+		// hash: the hash value of key given by hash_batch
+		storage_key(const key_type &key, size_t hash)
+			: _key(key), _hash(hash) { }
+
+		// the hash values of n keys, the same as the first
+		// constructor computes
+		static void
+		hash_batch(const key_type *keys, uint64_t *h, size_t n)
+		{
+			partition_type part;
+			for (size_t i = 0; i < n; ++i)
+				h[i] = part(keys[i]);
+			if (storage_hashed<_Storage>::value)
+				mix_hashes(h, n);
 		}
 
 		operator size_t () const
@@ -255,44 +453,87 @@ public:
 
 	typedef _Storage<storage_key, value_type, ulib_except,
 			 combiner_type, region_rwlock<ticket_rwlock_t> > storage_type;
-	typedef _Mapper<storage_type> mapper_type;
+	typedef _Context<storage_type, combiner_type> context_type;
+	typedef _Mapper<context_type> mapper_type;
+
+	typedef task<typename splitter_type::chunk_type, context_type, mapper_type> task_type;
+
+	// nworker: size of the private worker pool, zero means one
+	//	    worker per usable processor, see worker_pool
+	mc_runtime(splitter_type &sp, storage_type &stor, size_t nworker = 0)
+		: _splitter(sp), _storage(stor),
+		  _pool(new worker_pool(nworker)), _own_pool(true),
+		  _policy(schedule_queue), _grain(1) { }
+
+	// share the worker pool with other runtimes
+	mc_runtime(splitter_type &sp, storage_type &stor, worker_pool &pool)
+		: _splitter(sp), _storage(stor),
+		  _pool(&pool), _own_pool(false),
+		  _policy(schedule_queue), _grain(1) { }
+
+	virtual
+	~mc_runtime()
+	{
+		if (_own_pool)
+			delete _pool;
+	}
 
-	typedef task<typename splitter_type::chunk_type, storage_type, mapper_type> task_type;
+	void
+	run(size_t ntask = 0)
+	{ run(ntask, no_prototype()); }
 
-	mc_runtime(splitter_type &sp, storage_type &stor)
-		: _splitter(sp), _storage(stor)
-	{ _ncpu = sysconf(_SC_NPROCESSORS_ONLN); }
+	// see psm_runtime
+	template<typename _Proto>
+	void
+	run(size_t ntask, const _Proto &proto)
+	{ schedule<task_type>(*_pool, _splitter, contexts(), ntask, _policy, _grain, proto); }
 
+	// Select the chunk scheduling policy.
+	//     grain: chunks per task for schedule_steal
 	void
-	run(size_t ntask = 0)
+	set_schedule(schedule_policy policy, size_t grain = 16)
 	{
-		if (ntask == 0)
-			ntask = _ncpu;
-		task_type *tasks[ntask];
-		int ret = _splitter.split(ntask);
-		if (ret) {
-			ULIB_FATAL("split failed with nchunk=%zu", ntask);
-			return;
-		}
-		int t = 0;
-		for (; t < (int)_splitter.size(); ++t) {
-			if (t >= _ncpu) {
-				ULIB_FATAL("too many chunks, no greater than %d expected", _ncpu);
-				while (--t >= 0)
-					delete tasks[t];
-				return;
-			}
-			tasks[t] = new task_type(t, _splitter.chunk(t), _storage);
-			tasks[t]->start();
-		}
-		for (int i = 0; i < t; ++i)
-			delete tasks[i];
+		_policy = policy;
+		_grain	= grain;
 	}
 
+	// Set the number of slots of the per-worker combining cache,
+	// zero, the default, disables the cache.
+	void
+	set_cache(size_t nslot)
+	{ _config.cache = nslot; }
+
+	// Enable or disable batched combining into the storage, see
+	// mc_context.
+	void
+	set_batch(bool batch)
+	{ _config.batch = batch; }
+
+	worker_pool &
+	pool()
+	{ return *_pool; }
+
+protected:
+	// the task contexts, one per worker of the pool
+	context_type **
+	contexts()
+	{ return _ctxs.get(_storage, _pool->size(), _config); }
+
 private:
-	splitter_type &_splitter;
-	storage_type  &_storage;
-	int	       _ncpu;
+	mc_runtime(const mc_runtime &) { }
+
+	mc_runtime &
+	operator= (const mc_runtime &)
+	{ return *this; }
+
+	splitter_type	&_splitter;
+	storage_type	&_storage;
+	worker_pool	*_pool;
+	bool		 _own_pool;
+	schedule_policy	 _policy;
+	size_t		 _grain;
+	context_config	 _config;
+	context_array<context_type> _ctxs;
 };
 
 template<
@@ -309,8 +550,14 @@ public:
 	typedef mc_runtime<_Splitter, _Key, _Val, _Mapper, _Partition, _Combiner, multi_hash_map> runtime_type;
 
 	multi_hash_runtime(typename runtime_type::splitter_type &sp,
-			   typename runtime_type::storage_type &stor)
-		: runtime_type(sp, stor) { }
+			   typename runtime_type::storage_type &stor,
+			   size_t nworker = 0)
+		: runtime_type(sp, stor, nworker) { }
+
+	multi_hash_runtime(typename runtime_type::splitter_type &sp,
+			   typename runtime_type::storage_type &stor,
+			   worker_pool &pool)
+		: runtime_type(sp, stor, pool) { }
 };
 
 template<
@@ -327,8 +574,232 @@ public:
 	typedef mc_runtime<_Splitter, _Key, _Val, _Mapper, _Partition, _Combiner, chain_hash_map_r> runtime_type;
 
 	chain_hash_runtime(typename runtime_type::splitter_type &sp,
-			   typename runtime_type::storage_type &stor)
-		: runtime_type(sp, stor) { }
+			   typename runtime_type::storage_type &stor,
+			   size_t nworker = 0)
+		: runtime_type(sp, stor, nworker) { }
+
+	chain_hash_runtime(typename runtime_type::splitter_type &sp,
+			   typename runtime_type::storage_type &stor,
+			   worker_pool &pool)
+		: runtime_type(sp, stor, pool) { }
+};
+
+// Runtime over the lock-free storage, see lockfree_hash_map.
+template<
+	typename _Splitter,
+	typename _Key,
+	typename _Val,
+	template<typename _Storage> class _Mapper,
+	typename _Partition,
+	typename _Combiner = additive_combiner<_Val> >
+class lockfree_hash_runtime :
+		public mc_runtime<_Splitter, _Key, _Val, _Mapper,
+				  _Partition, _Combiner, lockfree_hash_map> {
+public:
+	typedef mc_runtime<_Splitter, _Key, _Val, _Mapper, _Partition, _Combiner, lockfree_hash_map> runtime_type;
+
+	lockfree_hash_runtime(typename runtime_type::splitter_type &sp,
+			      typename runtime_type::storage_type &stor,
+			      size_t nworker = 0)
+		: runtime_type(sp, stor, nworker) { }
+
+	lockfree_hash_runtime(typename runtime_type::splitter_type &sp,
+			      typename runtime_type::storage_type &stor,
+			      worker_pool &pool)
+		: runtime_type(sp, stor, pool) { }
+};
+
+// Runtime over the atomic combining storage, see atomic_hash_map.
+template<
+	typename _Splitter,
+	typename _Key,
+	typename _Val,
+	template<typename _Storage> class _Mapper,
+	typename _Partition,
+	typename _Combiner = additive_combiner<_Val> >
+class atomic_hash_runtime :
+		public mc_runtime<_Splitter, _Key, _Val, _Mapper,
+				  _Partition, _Combiner, atomic_hash_map> {
+public:
+	typedef mc_runtime<_Splitter, _Key, _Val, _Mapper, _Partition, _Combiner, atomic_hash_map> runtime_type;
+
+	atomic_hash_runtime(typename runtime_type::splitter_type &sp,
+			    typename runtime_type::storage_type &stor,
+			    size_t nworker = 0)
+		: runtime_type(sp, stor, nworker) { }
+
+	atomic_hash_runtime(typename runtime_type::splitter_type &sp,
+			    typename runtime_type::storage_type &stor,
+			    worker_pool &pool)
+		: runtime_type(sp, stor, pool) { }
+};
+
+// Runtime over the direct-indexed storage, see dense_array_map.
+template<
+	typename _Splitter,
+	typename _Key,
+	typename _Val,
+	template<typename _Storage> class _Mapper,
+	typename _Partition = simple_partition<_Key>,
+	typename _Combiner = additive_combiner<_Val> >
+class dense_array_runtime :
+		public mc_runtime<_Splitter, _Key, _Val, _Mapper,
+				  _Partition, _Combiner, dense_array_map> {
+public:
+	typedef mc_runtime<_Splitter, _Key, _Val, _Mapper, _Partition, _Combiner, dense_array_map> runtime_type;
+
+	dense_array_runtime(typename runtime_type::splitter_type &sp,
+			    typename runtime_type::storage_type &stor,
+			    size_t nworker = 0)
+		: runtime_type(sp, stor, nworker) { }
+
+	dense_array_runtime(typename runtime_type::splitter_type &sp,
+			    typename runtime_type::storage_type &stor,
+			    worker_pool &pool)
+		: runtime_type(sp, stor, pool) { }
+};
+
+// Two-phase runtime.
+// The map phase leaves the pairs in the task contexts, which are then
+// merged into the storage in parallel, each worker merging a disjoint
+// set of hash partitions.
+template<
+	typename _Splitter,
+	typename _Key,
+	typename _Val,
+	template<typename _Storage> class _Mapper,
+	typename _Partition,
+	typename _Combiner,
+	template<typename _CStorage, typename _CCombiner> class _Context>
+class merge_runtime :
+		public mc_runtime<_Splitter, _Key, _Val, _Mapper, _Partition,
+				  _Combiner, multi_hash_map, _Context> {
+public:
+	typedef mc_runtime<_Splitter, _Key, _Val, _Mapper, _Partition, _Combiner,
+			   multi_hash_map, _Context> runtime_type;
+
+	merge_runtime(typename runtime_type::splitter_type &sp,
+		      typename runtime_type::storage_type &stor,
+		      size_t nworker = 0)
+		: runtime_type(sp, stor, nworker) { }
+
+	merge_runtime(typename runtime_type::splitter_type &sp,
+		      typename runtime_type::storage_type &stor,
+		      worker_pool &pool)
+		: runtime_type(sp, stor, pool) { }
+
+	void
+	run(size_t ntask = 0)
+	{ run(ntask, no_prototype()); }
+
+	template<typename _Proto>
+	void
+	run(size_t ntask, const _Proto &proto)
+	{
+		runtime_type::run(ntask, proto);
+		merge_job<typename runtime_type::context_type> job(
+			this->contexts(), this->pool().size());
+		this->pool().run(job);
+	}
+};
+
+// Shared-nothing runtime.
+// The mappers of each worker combine into private tables without any
+// locks or atomics.
+template<
+	typename _Splitter,
+	typename _Key,
+	typename _Val,
+	template<typename _Storage> class _Mapper,
+	typename _Partition,
+	typename _Combiner = additive_combiner<_Val> >
+class private_hash_runtime :
+		public merge_runtime<_Splitter, _Key, _Val, _Mapper, _Partition,
+				     _Combiner, private_context> {
+public:
+	typedef merge_runtime<_Splitter, _Key, _Val, _Mapper, _Partition, _Combiner,
+			      private_context> runtime_type;
+
+	private_hash_runtime(typename runtime_type::splitter_type &sp,
+			     typename runtime_type::storage_type &stor,
+			     size_t nworker = 0)
+		: runtime_type(sp, stor, nworker) { }
+
+	private_hash_runtime(typename runtime_type::splitter_type &sp,
+			     typename runtime_type::storage_type &stor,
+			     worker_pool &pool)
+		: runtime_type(sp, stor, pool) { }
+};
+
+// Radix-partitioned runtime.
+// The mappers only append the pairs to per-partition buffers, and
+// each partition is aggregated by a single worker in a cache-sized
+// table afterwards. This suits high-cardinality key sets, for which
+// combining into a big table misses the cache on nearly every pair.
+template<
+	typename _Splitter,
+	typename _Key,
+	typename _Val,
+	template<typename _Storage> class _Mapper,
+	typename _Partition,
+	typename _Combiner = additive_combiner<_Val> >
+class radix_hash_runtime :
+		public merge_runtime<_Splitter, _Key, _Val, _Mapper, _Partition,
+				     _Combiner, radix_context> {
+public:
+	typedef merge_runtime<_Splitter, _Key, _Val, _Mapper, _Partition, _Combiner,
+			      radix_context> runtime_type;
+
+	radix_hash_runtime(typename runtime_type::splitter_type &sp,
+			   typename runtime_type::storage_type &stor,
+			   size_t nworker = 0)
+		: runtime_type(sp, stor, nworker) { }
+
+	radix_hash_runtime(typename runtime_type::splitter_type &sp,
+			   typename runtime_type::storage_type &stor,
+			   worker_pool &pool)
+		: runtime_type(sp, stor, pool) { }
+};
+
+// Delegation runtime.
+// Each hash partition is owned by one worker, which alone combines
+// into it; the others send it their pairs through SPSC rings. The
+// storage is only touched in the merge phase, one worker per key.
+template<
+	typename _Splitter,
+	typename _Key,
+	typename _Val,
+	template<typename _Storage> class _Mapper,
+	typename _Partition,
+	typename _Combiner = additive_combiner<_Val> >
+class delegate_runtime :
+		public merge_runtime<_Splitter, _Key, _Val, _Mapper, _Partition,
+				     _Combiner, delegate_context> {
+public:
+	typedef merge_runtime<_Splitter, _Key, _Val, _Mapper, _Partition, _Combiner,
+			      delegate_context> runtime_type;
+
+	delegate_runtime(typename runtime_type::splitter_type &sp,
+			 typename runtime_type::storage_type &stor,
+			 size_t nworker = 0)
+		: runtime_type(sp, stor, nworker) { }
+
+	delegate_runtime(typename runtime_type::splitter_type &sp,
+			 typename runtime_type::storage_type &stor,
+			 worker_pool &pool)
+		: runtime_type(sp, stor, pool) { }
+
+	void
+	run(size_t ntask = 0)
+	{ run(ntask, no_prototype()); }
+
+	template<typename _Proto>
+	void
+	run(size_t ntask, const _Proto &proto)
+	{
+		runtime_type::context_type::link(this->contexts(), this->pool().size());
+		runtime_type::run(ntask, proto);
+	}
 };
 
 }  // namespace mapcombine
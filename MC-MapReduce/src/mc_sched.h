@@ -0,0 +1,271 @@
+/* The MIT License
+
+   Copyright (C) 2012 Zilong Tan (eric.zltan@gmail.com)
+
+   Permission is hereby granted, free of charge, to any person
+   obtaining a copy of this software and associated documentation
+   files (the "Software"), to deal in the Software without
+   restriction, including without limitation the rights to use, copy,
+   modify, merge, publish, distribute, sublicense, and/or sell copies
+   of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+// This file implements the chunk schedulers.
+// A scheduler splits the data set and runs the resulting chunks as
+// a job on a worker pool. Any number of chunks can be multiplexed
+// over the workers of the pool. Two policies are provided:
+//     schedule_queue: the splitter yields one chunk per task and the
+//     chunks are queued; each worker repeatedly takes the next
+//     chunk from the queue until the queue is exhausted.
+//     schedule_steal: the splitter over-decomposes the data set into
+//     many small chunks which are dealt to per-worker deques; a
+//     worker that runs out of chunks steals from the others, so
+//     one slow chunk no longer determines the runtime. Thieves look
+//     for work on their own NUMA node first.
+
+#ifndef _ULIB_MC_SCHED_H
+#define _ULIB_MC_SCHED_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <algorithm>
+#include <ulib/util_log.h>
+#include <ulib/os_atomic_intel64.h>
+#include <ulib/mc_pool.h>
+#include <ulib/mc_context.h>
+#include <ulib/mc_task.h>
+
+namespace ulib {
+
+namespace mapcombine {
+
+enum schedule_policy {
+	schedule_queue,
+	schedule_steal
+};
+
+// Job that processes the chunks of a splitter through a shared
+// queue. The queue is a cursor over the chunk indices from which the
+// workers take chunks in order. Worker w emits through ctx[w], which
+// is flushed when the worker is done. The task of each worker is
+// built from proto, see task.
+template<typename _Splitter, typename _Task, typename _Proto = no_prototype>
+class queue_job : public job
+{
+public:
+	typedef _Splitter splitter_type;
+	typedef _Task	  task_type;
+	typedef typename _Task::pipeline_type pipeline_type;
+
+	queue_job(const splitter_type &sp, pipeline_type *const *ctx,
+		  const _Proto &proto)
+		: _splitter(sp), _ctx(ctx), _proto(proto), _next(0) { }
+
+	void
+	operator()(size_t wid)
+	{
+		size_t nchunk = _splitter.size();
+		size_t idx = atomic_fetchadd64(&_next, 1);
+		if (idx >= nchunk)
+			return;
+		task_type t(*_ctx[wid], _proto);
+		do
+			t.run(_splitter.chunk(idx));
+		while ((idx = atomic_fetchadd64(&_next, 1)) < nchunk);
+		_ctx[wid]->flush();
+	}
+
+private:
+	const splitter_type  &_splitter;
+	pipeline_type *const *_ctx;
+	const _Proto	     &_proto;
+	volatile int64_t      _next;
+};
+
+// Work-stealing deque of chunk indices.
+// The deque holds a contiguous index range [head, tail), both ends
+// being packed into a single word so that the owner and the thieves
+// can claim chunks with CAS. The owner takes chunks from the head,
+// whereas thieves take the upper half from the tail.
+struct steal_deque {
+	steal_deque() : range(0) { }
+
+	void
+	reset(uint32_t head, uint32_t tail)
+	{ range = ((uint64_t)tail << 32) | head; }
+
+	// take one chunk from the head
+	bool
+	pop(size_t &idx)
+	{
+		for (;;) {
+			uint64_t r = range;
+			uint32_t head = r;
+			if (head >= (uint32_t)(r >> 32))
+				return false;
+			if (atomic_cmpswp64(&range, r, r + 1) == (int64_t)r) {
+				idx = head;
+				return true;
+			}
+		}
+	}
+
+	// take the upper half of the chunks from the tail
+	bool
+	steal(uint32_t &head, uint32_t &tail)
+	{
+		for (;;) {
+			uint64_t r = range;
+			uint32_t h = r;
+			uint32_t t = r >> 32;
+			if (h >= t)
+				return false;
+			uint32_t m = t - (t - h + 1) / 2;
+			if (atomic_cmpswp64(&range, r, ((uint64_t)m << 32) | h) == (int64_t)r) {
+				head = m;
+				tail = t;
+				return true;
+			}
+		}
+	}
+
+	volatile uint64_t range;
+	// keep deques on separate cache lines
+	char pad[64 - sizeof(uint64_t)];
+};
+
+// Job that processes over-decomposed chunks with work stealing.
+template<typename _Splitter, typename _Task, typename _Proto = no_prototype>
+class steal_job : public job
+{
+public:
+	typedef _Splitter splitter_type;
+	typedef _Task	  task_type;
+	typedef typename _Task::pipeline_type pipeline_type;
+
+	steal_job(const splitter_type &sp, pipeline_type *const *ctx, size_t nworker,
+		  const cpu_placement &place, const _Proto &proto)
+		: _splitter(sp), _ctx(ctx), _proto(proto), _nworker(nworker)
+	{
+		size_t nchunk = sp.size();
+		_deques = new steal_deque [nworker];
+		// deal contiguous ranges to preserve locality
+		for (size_t w = 0; w < nworker; ++w) {
+			_deques[w].reset(w * nchunk / nworker, (w + 1) * nchunk / nworker);
+			_nodes.push_back(place.info(w).node);
+		}
+	}
+
+	virtual
+	~steal_job()
+	{ delete [] _deques; }
+
+	void
+	operator()(size_t wid)
+	{
+		if (wid >= _nworker)
+			return;
+		task_type t(*_ctx[wid], _proto);
+		steal_deque &own = _deques[wid];
+		size_t idx;
+		for (;;) {
+			while (own.pop(idx))
+				t.run(_splitter.chunk(idx));
+			if (!steal(wid))
+				break;
+		}
+		_ctx[wid]->flush();
+	}
+
+private:
+	// refill the deque of wid from the other workers, no chunk
+	// is left once a full pass finds all deques empty
+	bool
+	steal(size_t wid)
+	{
+		uint32_t head, tail;
+		// victims on the same node go first since their
+		// chunks are more likely in local memory
+		for (int pass = 0; pass < 2; ++pass) {
+			for (size_t i = 1; i < _nworker; ++i) {
+				size_t victim = (wid + i) % _nworker;
+				if ((_nodes[victim] == _nodes[wid]) == (pass == 1))
+					continue;
+				if (_deques[victim].steal(head, tail)) {
+					_deques[wid].reset(head, tail);
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	steal_job(const steal_job &) { }
+
+	steal_job &
+	operator= (const steal_job &)
+	{ return *this; }
+
+	const splitter_type  &_splitter;
+	pipeline_type *const *_ctx;
+	const _Proto	     &_proto;
+	size_t		      _nworker;
+	steal_deque	     *_deques;
+	std::vector<int>      _nodes;
+};
+
+// Split the data set and run the chunks on the pool.
+//     ctx: per-worker task contexts, one for each worker of the pool
+//     ntask: number of tasks, zero means one per worker; tasks are
+//	      multiplexed over the workers if there are more of them
+//     grain: number of chunks per task in schedule_steal
+//     proto: mapper prototype copied into every task, see task
+template<typename _Task, typename _Splitter, typename _Proto>
+int schedule(worker_pool &pool, _Splitter &sp, typename _Task::pipeline_type *const *ctx,
+	     size_t ntask, schedule_policy policy, size_t grain, const _Proto &proto)
+{
+	if (ntask == 0)
+		ntask = pool.size();
+	if (policy == schedule_steal) {
+		size_t nchunk = ntask * std::max(grain, (size_t)1);
+		if (sp.split(nchunk)) {
+			ULIB_FATAL("split failed with nchunk=%zu", nchunk);
+			return -1;
+		}
+		steal_job<_Splitter, _Task, _Proto> job(sp, ctx, std::min(ntask, pool.size()),
+							pool.placement(), proto);
+		pool.run(job);
+		return 0;
+	}
+	if (sp.split(ntask)) {
+		ULIB_FATAL("split failed with nchunk=%zu", ntask);
+		return -1;
+	}
+	queue_job<_Splitter, _Task, _Proto> job(sp, ctx, proto);
+	pool.run(job);
+	return 0;
+}
+
+template<typename _Task, typename _Splitter>
+int schedule(worker_pool &pool, _Splitter &sp, typename _Task::pipeline_type *const *ctx,
+	     size_t ntask, schedule_policy policy = schedule_queue, size_t grain = 1)
+{ return schedule<_Task>(pool, sp, ctx, ntask, policy, grain, no_prototype()); }
+
+}  // namespace mapcombine
+
+}  // namespace ulib
+
+#endif	/* _ULIB_MC_SCHED_H */
@@ -27,47 +27,153 @@
 #define _ULIB_MC_SET_H
 
 #include <assert.h>
+#include <new>
+#include <vector>
+#include <algorithm>
 #include <ulib/util_class.h>
 #include <ulib/hash_open.h>
 #include <ulib/math_bit.h>
+#include <ulib/mc_numa.h>
+#include <ulib/mc_swiss.h>
 
 namespace ulib {
 
 namespace mapcombine {
 
+// Multi hash set.
+// The set is split into a power of two of partitions by the low bits
+// of the hash value, and the partitions may be modified concurrently
+// as long as each is modified by one thread at a time, which is how
+// the PSM pipelines use them.
+// A partition normally holds a single sub-table. With set_split(),
+// a sub-table that grows past the limit is split in two by the next
+// high bit of the hash value, extendible hashing style, so the
+// number of sub-tables follows the cardinality online. The entries
+// of a split sub-table are migrated to its halves a few at a time by
+// the following insertions into the partition, which look up both
+// the halves and the sub-table until it is drained; no operation
+// ever rehashes a whole partition at once. A partition splits no
+// further sub-table until the last split is drained. Note that the
+// number of partitions, hence of PSM queues, stays fixed.
 template<typename _Key, typename _Except = ulib_except,
 	 typename _Combiner = do_nothing_combiner<_Key> >
 class multi_hash_set
 {
 public:
-	typedef open_hash_set<_Key, _Except>	  hash_set_type;
+	typedef typename subtable_set<_Key, _Except>::type hash_set_type;
 	typedef typename hash_set_type::key_type  key_type;
 	typedef typename hash_set_type::size_type size_type;
 
+private:
+	enum {
+		// entries migrated per insertion
+		MIGRATE_STEP = 4,
+		// maximum number of hash bits for splitting
+		MAX_DEPTH = 16
+	};
+
+	// sub-table covering the hash values whose top depth bits
+	// match
+	struct leaf {
+		leaf(size_t d, size_t nbucket = 0)
+			: set(nbucket), depth(d), pos(0) { }
+		hash_set_type set;
+		size_t depth;
+		// the position in partition::leaves
+		size_t pos;
+	};
+
+	// A partition indexes its sub-tables by the top depth bits of
+	// the hash value. While src is set, its entries are being
+	// migrated to the sub-tables that replaced it, from cursor on.
+	struct partition {
+		// nbucket: initial size of the sub-table
+		partition(size_t nbucket = 0)
+			: depth(0), src(NULL)
+		{
+			leaf *l = new leaf(0, nbucket);
+			dir.push_back(l);
+			attach(l);
+		}
+
+		~partition()
+		{
+			for (size_t i = 0; i < leaves.size(); ++i)
+				delete leaves[i];
+		}
+
+		leaf *
+		lookup(size_t h) const
+		{ return dir[depth? h >> (sizeof(size_t) * 8 - depth): 0]; }
+
+		void
+		attach(leaf *l)
+		{
+			l->pos = leaves.size();
+			leaves.push_back(l);
+		}
+
+		// remove l from leaves and delete it
+		void
+		detach(leaf *l)
+		{
+			leaves[l->pos] = leaves.back();
+			leaves[l->pos]->pos = l->pos;
+			leaves.pop_back();
+			delete l;
+		}
+
+		std::vector<leaf *> dir;
+		std::vector<leaf *> leaves;
+		size_t depth;
+		leaf  *src;
+		typename hash_set_type::iterator cursor;
+	};
+
+public:
 	multi_hash_set(size_t mhash)
+		: _split(0), _numa(false)
 	{
-		assert(mhash > 0);
-		assert(sizeof(mhash) == 4 || sizeof(mhash) == 8);
-		if (sizeof(mhash) == 8)
-			ROUND_UP64(mhash);
-		else
-			ROUND_UP32(mhash);
-		_mask = mhash - 1;
-		_ht = new hash_set_type [mhash];
+		_mask = round_up(mhash) - 1;
+		_parts = new partition [_mask + 1];
+	}
+
+	// NUMA mode: the partitions are spread over the workers of
+	// the pool in contiguous ranges and each is constructed, with
+	// the buckets of its sub-table for nkey / mhash keys, and thus
+	// first-touched on the node of its worker.
+	multi_hash_set(size_t mhash, worker_pool &pool, size_t nkey)
+		: _split(0), _numa(true)
+	{
+		_mask = round_up(mhash) - 1;
+		_parts = numa_new<partition>(pool, _mask + 1, nkey / (_mask + 1));
+		if (_parts == NULL)
+			throw std::bad_alloc();
 	}
 
 	virtual
 	~multi_hash_set()
-	{ delete [] _ht; }
+	{
+		if (_numa)
+			numa_delete(_parts, _mask + 1);
+		else
+			delete [] _parts;
+	}
 
 	struct iterator
 	{
 		typedef typename multi_hash_set<_Key, _Except, _Combiner>::key_type  key_type;
 		typedef typename multi_hash_set<_Key, _Except, _Combiner>::size_type size_type;
 
-		iterator(size_t id, size_t nht, hash_set_type *ht,
+		iterator(size_t pid, size_t lid, size_t npart, partition *parts,
 			 const typename hash_set_type::iterator &itr)
-			: _hid(id), _nht(nht), _ht(ht), _cur(itr) { }
+			: _pid(pid), _lid(lid), _npart(npart), _parts(parts), _cur(itr) { }
+
+		// the first entry at or after sub-table lid of
+		// partition pid
+		iterator(size_t pid, size_t lid, size_t npart, partition *parts)
+			: _pid(pid), _lid(lid), _npart(npart), _parts(parts)
+		{ skip(); }
 
 		iterator() { }
 
@@ -86,15 +192,11 @@ public:
 		iterator&
 		operator++()
 		{
-			if (_hid < _nht) {
+			if (_pid < _npart) {
 				++_cur;
-				if (_cur == _ht[_hid].end()) {
-					while (++_hid < _nht && _ht[_hid].size() == 0)
-						;
-					if (_hid < _nht)
-						_cur = _ht[_hid].begin();
-					else
-						_cur = _ht[_nht - 1].end();
+				if (_cur == _parts[_pid].leaves[_lid]->set.end()) {
+					++_lid;
+					skip();
 				}
 			}
 			return *this;
@@ -110,15 +212,34 @@ public:
 
 		bool
 		operator==(const iterator &other) const
-		{ return _hid == other._hid && _cur == other._cur; }
+		{
+			return _pid == other._pid && _lid == other._lid &&
+				(_pid == _npart || _cur == other._cur);
+		}
 
 		bool
 		operator!=(const iterator &other) const
-		{ return _hid != other._hid || _cur != other._cur; }
+		{ return !(*this == other); }
+
+		void
+		skip()
+		{
+			for (; _pid < _npart; ++_pid, _lid = 0) {
+				for (; _lid < _parts[_pid].leaves.size(); ++_lid) {
+					hash_set_type &h = _parts[_pid].leaves[_lid]->set;
+					if (h.size()) {
+						_cur = h.begin();
+						return;
+					}
+				}
+			}
+			_lid = 0;
+		}
 
-		size_t _hid;
-		size_t _nht;
-		hash_set_type *_ht;
+		size_t _pid;
+		size_t _lid;
+		size_t _npart;
+		partition *_parts;
 		typename hash_set_type::iterator _cur;
 	};
 
@@ -127,14 +248,18 @@ public:
 		typedef const typename multi_hash_set<_Key, _Except, _Combiner>::key_type key_type;
 		typedef typename multi_hash_set<_Key, _Except, _Combiner>::size_type	  size_type;
 
-		const_iterator(size_t id, size_t nht, const hash_set_type *ht,
+		const_iterator(size_t pid, size_t lid, size_t npart, const partition *parts,
 			       const typename hash_set_type::const_iterator &itr)
-			: _hid(id), _nht(nht), _ht(ht), _cur(itr) { }
+			: _pid(pid), _lid(lid), _npart(npart), _parts(parts), _cur(itr) { }
+
+		const_iterator(size_t pid, size_t lid, size_t npart, const partition *parts)
+			: _pid(pid), _lid(lid), _npart(npart), _parts(parts)
+		{ skip(); }
 
 		const_iterator() { }
 
 		const_iterator(const iterator &it)
-			: _hid(it._hid), _nht(it._nht), _ht(it._ht), _cur(it._cur) { }
+			: _pid(it._pid), _lid(it._lid), _npart(it._npart), _parts(it._parts), _cur(it._cur) { }
 
 		key_type &
 		key() const
@@ -151,15 +276,11 @@ public:
 		const_iterator &
 		operator++()
 		{
-			if (_hid < _nht) {
+			if (_pid < _npart) {
 				++_cur;
-				if (_cur == _ht[_hid].end()) {
-					while (++_hid < _nht && _ht[_hid].size() == 0)
-						;
-					if (_hid < _nht)
-						_cur = _ht[_hid].begin();
-					else
-						_cur = _ht[_nht - 1].end();
+				if (_cur == ((const hash_set_type &)_parts[_pid].leaves[_lid]->set).end()) {
+					++_lid;
+					skip();
 				}
 			}
 			return *this;
@@ -175,65 +296,78 @@ public:
 
 		bool
 		operator==(const const_iterator &other) const
-		{ return _hid == other._hid && _cur == other._cur; }
+		{
+			return _pid == other._pid && _lid == other._lid &&
+				(_pid == _npart || _cur == other._cur);
+		}
 
 		bool
 		operator!=(const const_iterator &other) const
-		{ return _hid != other._hid || _cur != other._cur; }
+		{ return !(*this == other); }
 
-		size_t _hid;
-		size_t _nht;
-		const hash_set_type *_ht;
+		void
+		skip()
+		{
+			for (; _pid < _npart; ++_pid, _lid = 0) {
+				for (; _lid < _parts[_pid].leaves.size(); ++_lid) {
+					const hash_set_type &h = _parts[_pid].leaves[_lid]->set;
+					if (h.size()) {
+						_cur = h.begin();
+						return;
+					}
+				}
+			}
+			_lid = 0;
+		}
+
+		size_t _pid;
+		size_t _lid;
+		size_t _npart;
+		const partition *_parts;
 		typename hash_set_type::const_iterator _cur;
 	};
 
 	iterator
 	begin()
-	{
-		size_t hid = 0;
-		while (hid <= _mask && _ht[hid].size() == 0)
-			++hid;
-		if (hid <= _mask)
-			return iterator(hid, _mask + 1, _ht, _ht[hid].begin());
-		else
-			return end();
-	}
+	{ return iterator(0, 0, _mask + 1, _parts); }
 
 	iterator
 	end()
-	{ return iterator(_mask + 1, _mask + 1, _ht, _ht[_mask].end()); }
+	{ return iterator(_mask + 1, 0, _mask + 1, _parts); }
 
 	const_iterator
 	begin() const
-	{
-		size_t hid = 0;
-		while (hid <= _mask && _ht[hid].size() == 0)
-			++hid;
-		if (hid <= _mask)
-			return const_iterator(hid, _mask + 1, _ht, _ht[hid].begin());
-		else
-			return end();
-	}
+	{ return const_iterator(0, 0, _mask + 1, _parts); }
 
 	const_iterator
 	end() const
-	{ return const_iterator(_mask + 1, _mask + 1, _ht, _ht[_mask].end()); }
+	{ return const_iterator(_mask + 1, 0, _mask + 1, _parts); }
+
+	// the entries of partition i
+	iterator
+	begin(size_t i)
+	{ return iterator(i, 0, _mask + 1, _parts); }
+
+	iterator
+	end(size_t i)
+	{ return iterator(i + 1, 0, _mask + 1, _parts); }
 
 	iterator
 	insert(const _Key &key)
 	{
-		size_t m = (size_t)key & _mask;
-		typename hash_set_type::iterator it =
-			_ht[m].insert(key);
-		return it == _ht[m].end()? end(): iterator(m, _mask + 1, _ht, it);
+		size_t h = (size_t)key;
+		size_t m = h & _mask;
+		partition &p = _parts[m];
+		migrate(p, MIGRATE_STEP);
+		iterator it = find(key);
+		if (it != end())
+			return it;
+		return add(m, key);
 	}
 
 	bool
 	contain(const _Key &key) const
-	{
-		size_t m = (size_t)key & _mask;
-		return _ht[m].contain(key);
-	}
+	{ return find(key) != end(); }
 
 	bool
 	operator[](const _Key &key) const
@@ -242,45 +376,99 @@ public:
 	iterator
 	find(const _Key &key)
 	{
-		size_t m = (size_t)key & _mask;
-		typename hash_set_type::iterator it = _ht[m].find(key);
-		return it == _ht[m].end()? end(): iterator(m, _mask + 1, _ht, it);
+		size_t h = (size_t)key;
+		size_t m = h & _mask;
+		partition &p = _parts[m];
+		leaf *l = p.lookup(h);
+		typename hash_set_type::iterator it = l->set.find(key);
+		if (it != l->set.end())
+			return iterator(m, l->pos, _mask + 1, _parts, it);
+		if (p.src) {
+			it = p.src->set.find(key);
+			if (it != p.src->set.end())
+				return iterator(m, p.src->pos, _mask + 1, _parts, it);
+		}
+		return end();
 	}
 
 	const_iterator
 	find(const _Key &key) const
-	{
-		size_t m = (size_t)key & _mask;
-		typename hash_set_type::const_iterator it = _ht[m].find(key);
-		return it == _ht[m].end()? end(): const_iterator(m, _mask + 1, _ht, it);
-	}
+	{ return const_cast<multi_hash_set *>(this)->find(key); }
 
 	void
 	combine(const _Key &key)
 	{
-		size_t m = (size_t)key & _mask;
-		typename hash_set_type::iterator it = _ht[m].find(key);
-		if (it == _ht[m].end())
-			_ht[m].insert(key);
-		else
+		size_t h = (size_t)key;
+		size_t m = h & _mask;
+		partition &p = _parts[m];
+		migrate(p, MIGRATE_STEP);
+		hash_set_type &s = p.lookup(h)->set;
+		typename hash_set_type::iterator it = s.find(key);
+		if (it != s.end()) {
 			_combiner(it.key(), key);
+			return;
+		}
+		if (p.src) {
+			// not migrated yet
+			it = p.src->set.find(key);
+			if (it != p.src->set.end()) {
+				_combiner(it.key(), key);
+				return;
+			}
+		}
+		add(m, key);
 	}
 
+	// Prefetch the sub-table slots of the keys whose hash value is
+	// h, see psm_combine_batch.
+	void
+	prefetch(size_t h) const
+	{ subtable_prefetch(_parts[h & _mask].lookup(h)->set, h); }
+
 	void
 	erase(const _Key &key)
-	{ _ht[(size_t)key & _mask].erase(key); }
+	{
+		iterator it = find(key);
+		if (it != end())
+			erase(it);
+	}
 
 	void
 	erase(const iterator &it)
-	{ _ht[it._hid].erase(it._cur); }
+	{ _parts[it._pid].leaves[it._lid]->set.erase(it._cur); }
 
 	void
 	clear()
 	{
 		for (size_t i = 0; i <= _mask; ++i)
-			_ht[i].clear();
+			clear(i);
 	}
 
+	// clear partition i, keeping its sub-tables
+	void
+	clear(size_t i)
+	{
+		partition &p = _parts[i];
+		if (p.src) {
+			p.detach(p.src);
+			p.src = NULL;
+		}
+		for (size_t k = 0; k < p.leaves.size(); ++k)
+			p.leaves[k]->set.clear();
+	}
+
+	// Split a sub-table once it holds limit entries; zero, the
+	// default, disables splitting. It must be set before the set
+	// is used concurrently.
+	void
+	set_split(size_t limit)
+	{ _split = limit; }
+
+	size_t
+	split_limit() const
+	{ return _split; }
+
+	// number of partitions
 	size_t
 	bucket_count() const
 	{ return _mask + 1; }
@@ -290,11 +478,90 @@ public:
 	{
 		size_t n = 0;
 		for (size_t i = 0; i <= _mask; ++i)
-			n += _ht[i].size();
+			for (size_t k = 0; k < _parts[i].leaves.size(); ++k)
+				n += _parts[i].leaves[k]->set.size();
 		return n;
 	}
 
 private:
+	// add a new key to partition m
+	iterator
+	add(size_t m, const _Key &key)
+	{
+		size_t h = (size_t)key;
+		partition &p = _parts[m];
+		leaf *l = p.lookup(h);
+		// a split waits for the previous one to drain, which
+		// takes a bounded number of insertions
+		if (_split && p.src == NULL && l->set.size() >= _split && l->depth < MAX_DEPTH) {
+			split(p, l);
+			l = p.lookup(h);
+		}
+		typename hash_set_type::iterator it = l->set.insert(key);
+		return iterator(m, l->pos, _mask + 1, _parts, it);
+	}
+
+	// replace l with two sub-tables of one more bit, l is then
+	// drained by migrate()
+	void
+	split(partition &p, leaf *l)
+	{
+		if (l->depth == p.depth) {
+			std::vector<leaf *> dir(p.dir.size() * 2);
+			for (size_t i = 0; i < dir.size(); ++i)
+				dir[i] = p.dir[i >> 1];
+			p.dir.swap(dir);
+			++p.depth;
+		}
+		leaf *l0 = new leaf(l->depth + 1);
+		leaf *l1 = new leaf(l->depth + 1);
+		// l covers a contiguous range of the directory
+		size_t from = std::find(p.dir.begin(), p.dir.end(), l) - p.dir.begin();
+		size_t half = (size_t)1 << (p.depth - l->depth - 1);
+		for (size_t i = 0; i < half; ++i) {
+			p.dir[from + i] = l0;
+			p.dir[from + half + i] = l1;
+		}
+		p.attach(l0);
+		p.attach(l1);
+		p.src	 = l;
+		p.cursor = l->set.begin();
+	}
+
+	// move up to n entries of the split sub-table of p to the
+	// sub-tables replacing it
+	void
+	migrate(partition &p, size_t n)
+	{
+		if (p.src == NULL)
+			return;
+		hash_set_type &s = p.src->set;
+		for (; n && p.cursor != s.end(); --n) {
+			typename hash_set_type::iterator it = p.cursor++;
+			// the copy takes over the entry, see psm_pipeline;
+			// the sub-table does not destruct what it erases
+			p.lookup((size_t)it.key())->set.insert(it.key());
+			it.key().~_Key();
+			s.erase(it);
+		}
+		if (p.cursor == s.end()) {
+			p.detach(p.src);
+			p.src = NULL;
+		}
+	}
+
+	static size_t
+	round_up(size_t mhash)
+	{
+		assert(mhash > 0);
+		assert(sizeof(mhash) == 4 || sizeof(mhash) == 8);
+		if (sizeof(mhash) == 8)
+			ROUND_UP64(mhash);
+		else
+			ROUND_UP32(mhash);
+		return mhash;
+	}
+
 	multi_hash_set(const multi_hash_set &other) { }
 
 	multi_hash_set &
@@ -302,8 +569,10 @@ private:
 	{ return *this; }
 
 	size_t _mask;
-	hash_set_type *_ht;
+	partition *_parts;
 	_Combiner _combiner;
+	size_t _split;
+	bool _numa;
 };
 
 }  // namespace mapcombine
@@ -0,0 +1,1394 @@
+/* The MIT License
+
+   Copyright (C) 2012 Zilong Tan (eric.zltan@gmail.com)
+
+   Permission is hereby granted, free of charge, to any person
+   obtaining a copy of this software and associated documentation
+   files (the "Software"), to deal in the Software without
+   restriction, including without limitation the rights to use, copy,
+   modify, merge, publish, distribute, sublicense, and/or sell copies
+   of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+
+// This file implements the concurrent storages with atomic combining.
+// lockfree_hash_map is a linear probing table which serves the same
+// interface as multi_hash_map, hence can be used as the storage of
+// mc_runtime. Slots are claimed with CAS on a tag word and values
+// are combined with CAS loops, so combining never takes a lock. Keys
+// and values must be trivially copyable, and values must be of 4 or
+// 8 bytes. The table does not grow; it must be sized for the number
+// of distinct keys.
+// atomic_hash_map keeps the growable sub-tables of multi_hash_map
+// but combines existing keys with atomic operations under a shared
+// lock whenever the combiner allows it.
+// dense_array_map is an array indexed directly by the key for keys
+// known to lie in a small range [0, range), so that neither hashing
+// nor probing is involved.
+
+#ifndef _ULIB_MC_STORAGE_H
+#define _ULIB_MC_STORAGE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <new>
+#include <utility>
+#include <ulib/math_bit.h>
+#include <ulib/util_class.h>
+#include <ulib/hash_open.h>
+#include <ulib/os_atomic_intel64.h>
+#include <ulib/mc_typedef.h>
+#include <ulib/mc_swiss.h>
+#include <ulib/mc_sync.h>
+
+namespace ulib {
+
+namespace mapcombine {
+
+// Atomically replace *sum with s if it still equals old.
+template<typename _Val>
+static inline bool atomic_replace(volatile _Val *sum, const _Val &old, const _Val &s)
+{
+	// only 4- and 8-byte values are supported
+	typedef char value_must_be_a_word[sizeof(_Val) == 4 || sizeof(_Val) == 8? 1: -1];
+	(void)sizeof(value_must_be_a_word);
+
+	if (sizeof(_Val) == 8) {
+		int64_t o, n;
+		memcpy(&o, &old, 8);
+		memcpy(&n, &s, 8);
+		return atomic_cmpswp64(sum, o, n) == o;
+	} else {
+		int32_t o, n;
+		memcpy(&o, &old, 4);
+		memcpy(&n, &s, 4);
+		return atomic_cmpswp32(sum, o, n) == o;
+	}
+}
+
+// Atomically combine value into the word-sized *sum.
+template<typename _Val, typename _Combiner>
+static inline void atomic_combine(volatile _Val *sum, const _Val &value, const _Combiner &combiner)
+{
+	for (;;) {
+		_Val old;
+		memcpy(&old, (const void *)sum, sizeof(_Val));
+		_Val s = old;
+		combiner(s, value);
+		if (atomic_replace(sum, old, s))
+			return;
+		atomic_cpu_relax();
+	}
+}
+
+// Word-sized arithmetic types, which the atomic combiners below
+// operate on.
+template<typename _Val>
+struct atomic_arith {
+	enum { value = 0, integral = 0 };
+};
+
+#define MC_ATOMIC_ARITH(type, isint)					\
+	template<>							\
+	struct atomic_arith<type> {					\
+		enum { value = sizeof(type) == 4 || sizeof(type) == 8,	\
+		       integral = isint };				\
+	}
+
+MC_ATOMIC_ARITH(int, 1);
+MC_ATOMIC_ARITH(unsigned int, 1);
+MC_ATOMIC_ARITH(long, 1);
+MC_ATOMIC_ARITH(unsigned long, 1);
+MC_ATOMIC_ARITH(long long, 1);
+MC_ATOMIC_ARITH(unsigned long long, 1);
+MC_ATOMIC_ARITH(float, 0);
+MC_ATOMIC_ARITH(double, 0);
+
+#undef MC_ATOMIC_ARITH
+
+// Atomic equivalents of the combiners.
+// atomic_op<_Combiner, _Val>::value is nonzero if the combiner has
+// an equivalent apply() which updates the sum in place without a
+// lock. This is detected at compile time for the additive, min and
+// max combiners of word-sized arithmetic values: integer additions
+// become fetch-adds, the others CAS loops which give up as soon as
+// the sum needs no update.
+template<typename _Combiner, typename _Val>
+struct atomic_op {
+	enum { value = 0 };
+};
+
+template<typename _Val>
+struct atomic_op<additive_combiner<_Val>, _Val> {
+	enum { value = atomic_arith<_Val>::value };
+
+	static void
+	apply(volatile _Val *sum, const _Val &value)
+	{
+		if (!atomic_arith<_Val>::integral)
+			atomic_combine(sum, value, additive_combiner<_Val>());
+		else if (sizeof(_Val) == 8)
+			atomic_fetchadd64(sum, (int64_t)value);
+		else
+			atomic_fetchadd32(sum, (int32_t)value);
+	}
+};
+
+template<typename _Val>
+struct atomic_op<min_combiner<_Val>, _Val> {
+	enum { value = atomic_arith<_Val>::value };
+
+	static void
+	apply(volatile _Val *sum, const _Val &value)
+	{
+		for (;;) {
+			_Val old = *sum;
+			if (!(value < old) || atomic_replace(sum, old, value))
+				return;
+			atomic_cpu_relax();
+		}
+	}
+};
+
+template<typename _Val>
+struct atomic_op<max_combiner<_Val>, _Val> {
+	enum { value = atomic_arith<_Val>::value };
+
+	static void
+	apply(volatile _Val *sum, const _Val &value)
+	{
+		for (;;) {
+			_Val old = *sum;
+			if (!(old < value) || atomic_replace(sum, old, value))
+				return;
+			atomic_cpu_relax();
+		}
+	}
+};
+
+// Overload selectors for the combining paths.
+template<bool _Atomic>
+struct atomic_tag { };
+
+template<typename _Val, typename _Combiner>
+static inline void atomic_update(volatile _Val *sum, const _Val &value,
+				 const _Combiner &, atomic_tag<true>)
+{ atomic_op<_Combiner, _Val>::apply(sum, value); }
+
+template<typename _Val, typename _Combiner>
+static inline void atomic_update(volatile _Val *sum, const _Val &value,
+				 const _Combiner &combiner, atomic_tag<false>)
+{ atomic_combine(sum, value, combiner); }
+
+// Atomically combine value into the word-sized *sum, using the
+// atomic equivalent of the combiner if there is one.
+template<typename _Val, typename _Combiner>
+static inline void atomic_update(volatile _Val *sum, const _Val &value,
+				 const _Combiner &combiner)
+{
+	atomic_update(sum, value, combiner,
+		      atomic_tag<atomic_op<_Combiner, _Val>::value != 0>());
+}
+
+// Lock-free linear probing hash map.
+// The template parameters follow multi_hash_map; _RegionLock is not
+// used. Only combine, insert, find and operator[] are safe to call
+// concurrently; erase and clear are not.
+template<typename _Key, typename _Val, typename _Except = ulib_except,
+	 typename _Combiner = do_nothing_combiner<_Val>, typename _RegionLock = void>
+class lockfree_hash_map {
+private:
+	// tag values, the others being hash values
+	enum { TAG_EMPTY = 0, TAG_BUSY = 1, TAG_ERASED = 2, TAG_MIN = 3 };
+
+	struct slot {
+		volatile size_t tag;
+		_Val value;
+		_Key &
+		key()
+		{ return *(_Key *)_key; }
+
+		const _Key &
+		key() const
+		{ return *(const _Key *)_key; }
+
+		union {
+			char _key[sizeof(_Key)];
+			uint64_t _align;
+		};
+	};
+
+public:
+	typedef _Key   key_type;
+	typedef _Val   value_type;
+	typedef size_t size_type;
+
+	struct iterator
+	{
+		iterator(slot *cur, slot *end)
+			: _cur(cur), _end(end)
+		{ skip(); }
+
+		iterator() { }
+
+		_Key &
+		key() const
+		{ return _cur->key(); }
+
+		_Val &
+		value() const
+		{ return _cur->value; }
+
+		iterator &
+		operator++()
+		{
+			++_cur;
+			skip();
+			return *this;
+		}
+
+		iterator
+		operator++(int)
+		{
+			iterator old = *this;
+			++*this;
+			return old;
+		}
+
+		bool
+		operator==(const iterator &other) const
+		{ return _cur == other._cur; }
+
+		bool
+		operator!=(const iterator &other) const
+		{ return _cur != other._cur; }
+
+		void
+		skip()
+		{
+			while (_cur != _end && _cur->tag < TAG_MIN)
+				++_cur;
+		}
+
+		slot *_cur;
+		slot *_end;
+	};
+
+	struct const_iterator
+	{
+		const_iterator(const slot *cur, const slot *end)
+			: _cur(cur), _end(end)
+		{ skip(); }
+
+		const_iterator(const iterator &it)
+			: _cur(it._cur), _end(it._end) { }
+
+		const_iterator() { }
+
+		const _Key &
+		key() const
+		{ return _cur->key(); }
+
+		const _Val &
+		value() const
+		{ return _cur->value; }
+
+		const_iterator &
+		operator++()
+		{
+			++_cur;
+			skip();
+			return *this;
+		}
+
+		const_iterator
+		operator++(int)
+		{
+			const_iterator old = *this;
+			++*this;
+			return old;
+		}
+
+		bool
+		operator==(const const_iterator &other) const
+		{ return _cur == other._cur; }
+
+		bool
+		operator!=(const const_iterator &other) const
+		{ return _cur != other._cur; }
+
+		void
+		skip()
+		{
+			while (_cur != _end && _cur->tag < TAG_MIN)
+				++_cur;
+		}
+
+		const slot *_cur;
+		const slot *_end;
+	};
+
+	// capacity: maximum number of keys, the table keeps twice as
+	// many slots
+	lockfree_hash_map(size_t capacity)
+		: _size(0)
+	{
+		size_t n = capacity * 2;
+		if (n < 2)
+			n = 2;
+		if (sizeof(n) == 8)
+			ROUND_UP64(n);
+		else
+			ROUND_UP32(n);
+		_mask  = n - 1;
+		_slots = (slot *)::operator new(sizeof(slot) * n);
+		for (size_t i = 0; i < n; ++i)
+			_slots[i].tag = TAG_EMPTY;
+	}
+
+	~lockfree_hash_map()
+	{
+		clear();
+		::operator delete(_slots);
+	}
+
+	iterator
+	begin()
+	{ return iterator(_slots, _slots + _mask + 1); }
+
+	iterator
+	end()
+	{ return iterator(_slots + _mask + 1, _slots + _mask + 1); }
+
+	const_iterator
+	begin() const
+	{ return const_iterator(_slots, _slots + _mask + 1); }
+
+	const_iterator
+	end() const
+	{ return const_iterator(_slots + _mask + 1, _slots + _mask + 1); }
+
+	// insert or replace the value of key
+	iterator
+	insert(const _Key &key, const _Val &value)
+	{
+		bool added;
+		slot *s = acquire(key, value, added);
+		if (!added)
+			atomic_combine(&s->value, value, replace_combiner());
+		return iterator(s, _slots + _mask + 1);
+	}
+
+	void
+	combine(const _Key &key, const _Val &value)
+	{
+		bool added;
+		slot *s = acquire(key, value, added);
+		if (!added)
+			atomic_update(&s->value, value, _combiner);
+	}
+
+	// prefetch the home slot of key, see storage_combine_batch
+	void
+	prefetch(const _Key &key) const
+	{ __builtin_prefetch(_slots + (tag_of(key) & _mask), 1); }
+
+	iterator
+	find(const _Key &key)
+	{
+		slot *s = lookup(key);
+		return s? iterator(s, _slots + _mask + 1): end();
+	}
+
+	const_iterator
+	find(const _Key &key) const
+	{
+		slot *s = lookup(key);
+		return s? const_iterator(s, _slots + _mask + 1): end();
+	}
+
+	// the value of key, which is inserted with the default value
+	// if absent
+	_Val &
+	operator[](const _Key &key)
+	{
+		bool added;
+		return acquire(key, _Val(), added)->value;
+	}
+
+	void
+	erase(const _Key &key)
+	{
+		slot *s = lookup(key);
+		if (s) {
+			s->key().~_Key();
+			s->tag = TAG_ERASED;
+			atomic_fetchadd64(&_size, -1);
+		}
+	}
+
+	void
+	clear()
+	{
+		for (size_t i = 0; i <= _mask; ++i) {
+			if (_slots[i].tag >= TAG_MIN)
+				_slots[i].key().~_Key();
+			_slots[i].tag = TAG_EMPTY;
+		}
+		_size = 0;
+	}
+
+	size_t
+	size() const
+	{ return _size; }
+
+	size_t
+	bucket_count() const
+	{ return _mask + 1; }
+
+private:
+	struct replace_combiner {
+		void
+		operator()(_Val &sum, const _Val &value) const
+		{ sum = value; }
+	};
+
+	static size_t
+	tag_of(const _Key &key)
+	{
+		size_t h = (size_t)key;
+		return h < TAG_MIN? h + TAG_MIN: h;
+	}
+
+	// find the slot of key, or claim one for it with value
+	slot *
+	acquire(const _Key &key, const _Val &value, bool &added)
+	{
+		size_t h = tag_of(key);
+		size_t i = h & _mask;
+		for (size_t n = 0; n <= _mask; ++n, i = (i + 1) & _mask) {
+			slot *s = _slots + i;
+			size_t t = s->tag;
+			if (t == TAG_EMPTY) {
+				if (atomic_cmpswp64(&s->tag, TAG_EMPTY, TAG_BUSY) == TAG_EMPTY) {
+					new (s->_key) _Key(key);
+					s->value = value;
+					atomic_barrier();
+					s->tag = h;
+					atomic_fetchadd64(&_size, 1);
+					added = true;
+					return s;
+				}
+				t = s->tag;
+			}
+			// wait for the claimer to publish the key
+			while (t == TAG_BUSY) {
+				atomic_cpu_relax();
+				t = s->tag;
+			}
+			if (t == h && s->key() == key) {
+				added = false;
+				return s;
+			}
+		}
+		throw _Except();
+	}
+
+	slot *
+	lookup(const _Key &key) const
+	{
+		size_t h = tag_of(key);
+		size_t i = h & _mask;
+		for (size_t n = 0; n <= _mask; ++n, i = (i + 1) & _mask) {
+			slot *s = _slots + i;
+			size_t t = s->tag;
+			if (t == TAG_EMPTY)
+				return NULL;
+			while (t == TAG_BUSY) {
+				atomic_cpu_relax();
+				t = s->tag;
+			}
+			if (t == h && s->key() == key)
+				return s;
+		}
+		return NULL;
+	}
+
+	lockfree_hash_map(const lockfree_hash_map &) { }
+
+	lockfree_hash_map &
+	operator= (const lockfree_hash_map &)
+	{ return *this; }
+
+	size_t		 _mask;
+	slot		*_slots;
+	volatile int64_t _size;
+	_Combiner	 _combiner;
+};
+
+// Multi hash map with atomic combining.
+// The map is split into sub-tables like multi_hash_map, but each
+// sub-table is guarded by a reader-writer spin lock instead of a
+// region lock, which is why _RegionLock is not used. If the combiner
+// has an atomic equivalent (see atomic_op), combining an existing
+// key is a single atomic update under the shared lock, and only the
+// insertion of a new key takes the exclusive lock. Otherwise every
+// combine takes the exclusive lock. As with multi_hash_map, only
+// combine and insert are safe to call concurrently.
+template<typename _Key, typename _Val, typename _Except = ulib_except,
+	 typename _Combiner = do_nothing_combiner<_Val>, typename _RegionLock = void>
+class atomic_hash_map {
+public:
+	typedef typename subtable_map<_Key, _Val, _Except>::type hash_map_type;
+	typedef _Key   key_type;
+	typedef _Val   value_type;
+	typedef size_t size_type;
+
+	struct iterator
+	{
+		iterator(size_t id, size_t nht, hash_map_type *ht,
+			 const typename hash_map_type::iterator &itr)
+			: _hid(id), _nht(nht), _ht(ht), _cur(itr) { }
+
+		iterator() { }
+
+		_Key &
+		key() const
+		{ return _cur.key(); }
+
+		_Val &
+		value() const
+		{ return _cur.value(); }
+
+		iterator &
+		operator++()
+		{
+			if (_hid < _nht) {
+				++_cur;
+				if (_cur == _ht[_hid].end()) {
+					while (++_hid < _nht && _ht[_hid].size() == 0)
+						;
+					if (_hid < _nht)
+						_cur = _ht[_hid].begin();
+					else
+						_cur = _ht[_nht - 1].end();
+				}
+			}
+			return *this;
+		}
+
+		iterator
+		operator++(int)
+		{
+			iterator old = *this;
+			++*this;
+			return old;
+		}
+
+		bool
+		operator==(const iterator &other) const
+		{ return _hid == other._hid && _cur == other._cur; }
+
+		bool
+		operator!=(const iterator &other) const
+		{ return _hid != other._hid || _cur != other._cur; }
+
+		size_t _hid;
+		size_t _nht;
+		hash_map_type *_ht;
+		typename hash_map_type::iterator _cur;
+	};
+
+	struct const_iterator
+	{
+		const_iterator(size_t id, size_t nht, const hash_map_type *ht,
+			       const typename hash_map_type::const_iterator &itr)
+			: _hid(id), _nht(nht), _ht(ht), _cur(itr) { }
+
+		const_iterator() { }
+
+		const_iterator(const iterator &it)
+			: _hid(it._hid), _nht(it._nht), _ht(it._ht), _cur(it._cur) { }
+
+		const _Key &
+		key() const
+		{ return _cur.key(); }
+
+		const _Val &
+		value() const
+		{ return _cur.value(); }
+
+		const_iterator &
+		operator++()
+		{
+			if (_hid < _nht) {
+				++_cur;
+				if (_cur == _ht[_hid].end()) {
+					while (++_hid < _nht && _ht[_hid].size() == 0)
+						;
+					if (_hid < _nht)
+						_cur = _ht[_hid].begin();
+					else
+						_cur = _ht[_nht - 1].end();
+				}
+			}
+			return *this;
+		}
+
+		const_iterator
+		operator++(int)
+		{
+			const_iterator old = *this;
+			++*this;
+			return old;
+		}
+
+		bool
+		operator==(const const_iterator &other) const
+		{ return _hid == other._hid && _cur == other._cur; }
+
+		bool
+		operator!=(const const_iterator &other) const
+		{ return _hid != other._hid || _cur != other._cur; }
+
+		size_t _hid;
+		size_t _nht;
+		const hash_map_type *_ht;
+		typename hash_map_type::const_iterator _cur;
+	};
+
+	// mhash: number of sub-tables, rounded up to a power of two
+	atomic_hash_map(size_t mhash)
+	{
+		if (mhash == 0)
+			mhash = 1;
+		if (sizeof(mhash) == 8)
+			ROUND_UP64(mhash);
+		else
+			ROUND_UP32(mhash);
+		_mask  = mhash - 1;
+		_ht    = new hash_map_type [mhash];
+		_locks = new lock [mhash];
+	}
+
+	~atomic_hash_map()
+	{
+		delete [] _ht;
+		delete [] _locks;
+	}
+
+	iterator
+	begin()
+	{
+		size_t hid = 0;
+		while (hid <= _mask && _ht[hid].size() == 0)
+			++hid;
+		if (hid <= _mask)
+			return iterator(hid, _mask + 1, _ht, _ht[hid].begin());
+		else
+			return end();
+	}
+
+	iterator
+	end()
+	{ return iterator(_mask + 1, _mask + 1, _ht, _ht[_mask].end()); }
+
+	const_iterator
+	begin() const
+	{
+		size_t hid = 0;
+		while (hid <= _mask && _ht[hid].size() == 0)
+			++hid;
+		if (hid <= _mask)
+			return const_iterator(hid, _mask + 1, _ht, _ht[hid].begin());
+		else
+			return end();
+	}
+
+	const_iterator
+	end() const
+	{ return const_iterator(_mask + 1, _mask + 1, _ht, _ht[_mask].end()); }
+
+	// insert or replace the value of key
+	iterator
+	insert(const _Key &key, const _Val &value)
+	{
+		size_t m = (size_t)key & _mask;
+		wrlock(m);
+		typename hash_map_type::iterator it = _ht[m].insert(key, value);
+		unlock(m);
+		return iterator(m, _mask + 1, _ht, it);
+	}
+
+	void
+	combine(const _Key &key, const _Val &value)
+	{ combine(key, value, atomic_tag<atomic_op<_Combiner, _Val>::value != 0>()); }
+
+#if __cplusplus >= 201103L
+	// the same as above, with the key and the value of a new key
+	// moved into its sub-table
+	void
+	combine(_Key &&key, _Val &&value)
+	{
+		// atomically combined values are words, nothing to move
+		if (atomic_op<_Combiner, _Val>::value) {
+			combine(key, value);
+			return;
+		}
+		size_t m = (size_t)key & _mask;
+		wrlock(m);
+		typename hash_map_type::iterator it = _ht[m].find(key);
+		if (it == _ht[m].end())
+			subtable_emplace(_ht[m], std::move(key), std::move(value));
+		else
+			_combiner(it.value(), value);
+		unlock(m);
+	}
+#endif
+
+	// Prefetch the lock and the sub-table slots of key, see
+	// storage_combine_batch. Being a mere hint, it takes no lock.
+	void
+	prefetch(const _Key &key) const
+	{
+		size_t m = (size_t)key & _mask;
+		__builtin_prefetch(_locks + m, 1);
+		subtable_prefetch(_ht[m], (size_t)key);
+	}
+
+	iterator
+	find(const _Key &key)
+	{
+		size_t m = (size_t)key & _mask;
+		typename hash_map_type::iterator it = _ht[m].find(key);
+		return it == _ht[m].end()? end(): iterator(m, _mask + 1, _ht, it);
+	}
+
+	const_iterator
+	find(const _Key &key) const
+	{
+		size_t m = (size_t)key & _mask;
+		typename hash_map_type::const_iterator it = _ht[m].find(key);
+		return it == _ht[m].end()? end(): const_iterator(m, _mask + 1, _ht, it);
+	}
+
+	_Val &
+	operator[](const _Key &key)
+	{ return _ht[(size_t)key & _mask][key]; }
+
+	void
+	erase(const _Key &key)
+	{ _ht[(size_t)key & _mask].erase(key); }
+
+	void
+	clear()
+	{
+		for (size_t i = 0; i <= _mask; ++i)
+			_ht[i].clear();
+	}
+
+	size_t
+	size() const
+	{
+		size_t n = 0;
+		for (size_t i = 0; i <= _mask; ++i)
+			n += _ht[i].size();
+		return n;
+	}
+
+	size_t
+	bucket_count() const
+	{ return _mask + 1; }
+
+private:
+	// reader-writer spin lock: the word counts the readers, a
+	// writer first sets WAIT to keep new readers out, then takes
+	// the lock by turning the drained word into WRITE
+	enum { WAIT = 1 << 30, WRITE = 1 << 29 };
+
+	struct lock {
+		lock() : word(0) { }
+		volatile int64_t word;
+		char pad[64 - sizeof(int64_t)];
+	};
+
+	void
+	rdlock(size_t m)
+	{
+		volatile int64_t *w = &_locks[m].word;
+		psm_backoff backoff;
+		for (;;) {
+			int64_t v = *w;
+			if ((v & (WAIT | WRITE)) == 0 &&
+			    atomic_cmpswp64(w, v, v + 1) == v)
+				return;
+			backoff();
+		}
+	}
+
+	void
+	rdunlock(size_t m)
+	{ atomic_fetchadd64(&_locks[m].word, -1); }
+
+	void
+	wrlock(size_t m)
+	{
+		volatile int64_t *w = &_locks[m].word;
+		psm_backoff backoff;
+		for (;;) {
+			int64_t v = *w;
+			if ((v & WAIT) == 0 &&
+			    atomic_cmpswp64(w, v, v | WAIT) == v)
+				break;
+			backoff();
+		}
+		while (atomic_cmpswp64(w, WAIT, WRITE) != WAIT)
+			atomic_cpu_relax();
+	}
+
+	void
+	unlock(size_t m)
+	{
+		atomic_barrier();
+		_locks[m].word = 0;
+	}
+
+	// an existing key is combined atomically under the shared
+	// lock, a new one is inserted under the exclusive lock
+	void
+	combine(const _Key &key, const _Val &value, atomic_tag<true>)
+	{
+		size_t m = (size_t)key & _mask;
+		rdlock(m);
+		typename hash_map_type::iterator it = _ht[m].find(key);
+		if (it != _ht[m].end()) {
+			atomic_op<_Combiner, _Val>::apply(&it.value(), value);
+			rdunlock(m);
+			return;
+		}
+		rdunlock(m);
+		combine(key, value, atomic_tag<false>());
+	}
+
+	void
+	combine(const _Key &key, const _Val &value, atomic_tag<false>)
+	{
+		size_t m = (size_t)key & _mask;
+		wrlock(m);
+		typename hash_map_type::iterator it = _ht[m].find(key);
+		if (it == _ht[m].end())
+			_ht[m].insert(key, value);
+		else
+			_combiner(it.value(), value);
+		unlock(m);
+	}
+
+	atomic_hash_map(const atomic_hash_map &) { }
+
+	atomic_hash_map &
+	operator= (const atomic_hash_map &)
+	{ return *this; }
+
+	size_t	       _mask;
+	hash_map_type *_ht;
+	lock	      *_locks;
+	_Combiner      _combiner;
+};
+
+// Direct-indexed storage for keys in a dense range.
+// The template parameters follow multi_hash_map; _RegionLock is not
+// used. Key k, converted with size_t, lives in slot k of an array
+// of range slots; keys out of the range raise _Except. Each slot has
+// a state word: a new key claims its slot with CAS, an existing key
+// is combined with the atomic equivalent of the combiner if there
+// is one (see atomic_op), and otherwise under the state word used as
+// a spin lock. Unlike the other storages, the keys mc_runtime passes
+// to it are not hashed (see storage_hashed), so the partition must
+// map the keys to the range, e.g., simple_partition of integers.
+// Only combine, insert, find and operator[] are safe to call
+// concurrently; erase and clear are not.
+template<typename _Key, typename _Val, typename _Except = ulib_except,
+	 typename _Combiner = do_nothing_combiner<_Val>, typename _RegionLock = void>
+class dense_array_map {
+private:
+	enum { STATE_EMPTY = 0, STATE_BUSY = 1, STATE_FULL = 2 };
+
+	struct slot {
+		volatile int64_t state;
+		_Val value;
+		_Key &
+		key()
+		{ return *(_Key *)_key; }
+
+		const _Key &
+		key() const
+		{ return *(const _Key *)_key; }
+
+		union {
+			char _key[sizeof(_Key)];
+			uint64_t _align;
+		};
+	};
+
+public:
+	typedef _Key   key_type;
+	typedef _Val   value_type;
+	typedef size_t size_type;
+
+	struct iterator
+	{
+		iterator(char *cur, char *end, size_t stride)
+			: _cur(cur), _end(end), _stride(stride)
+		{ skip(); }
+
+		iterator() { }
+
+		_Key &
+		key() const
+		{ return ((slot *)_cur)->key(); }
+
+		_Val &
+		value() const
+		{ return ((slot *)_cur)->value; }
+
+		iterator &
+		operator++()
+		{
+			_cur += _stride;
+			skip();
+			return *this;
+		}
+
+		iterator
+		operator++(int)
+		{
+			iterator old = *this;
+			++*this;
+			return old;
+		}
+
+		bool
+		operator==(const iterator &other) const
+		{ return _cur == other._cur; }
+
+		bool
+		operator!=(const iterator &other) const
+		{ return _cur != other._cur; }
+
+		void
+		skip()
+		{
+			while (_cur != _end && ((slot *)_cur)->state != STATE_FULL)
+				_cur += _stride;
+		}
+
+		char  *_cur;
+		char  *_end;
+		size_t _stride;
+	};
+
+	struct const_iterator
+	{
+		const_iterator(const char *cur, const char *end, size_t stride)
+			: _cur(cur), _end(end), _stride(stride)
+		{ skip(); }
+
+		const_iterator(const iterator &it)
+			: _cur(it._cur), _end(it._end), _stride(it._stride) { }
+
+		const_iterator() { }
+
+		const _Key &
+		key() const
+		{ return ((const slot *)_cur)->key(); }
+
+		const _Val &
+		value() const
+		{ return ((const slot *)_cur)->value; }
+
+		const_iterator &
+		operator++()
+		{
+			_cur += _stride;
+			skip();
+			return *this;
+		}
+
+		const_iterator
+		operator++(int)
+		{
+			const_iterator old = *this;
+			++*this;
+			return old;
+		}
+
+		bool
+		operator==(const const_iterator &other) const
+		{ return _cur == other._cur; }
+
+		bool
+		operator!=(const const_iterator &other) const
+		{ return _cur != other._cur; }
+
+		void
+		skip()
+		{
+			while (_cur != _end && ((const slot *)_cur)->state != STATE_FULL)
+				_cur += _stride;
+		}
+
+		const char *_cur;
+		const char *_end;
+		size_t	    _stride;
+	};
+
+	// range: keys lie in [0, range)
+	// pad: give each slot its own cache line, which avoids false
+	// sharing when a few hot keys are combined by all workers
+	dense_array_map(size_t range, bool pad = false)
+		: _range(range), _size(0)
+	{
+		_stride = sizeof(slot);
+		if (pad)
+			_stride = (_stride + 63) & ~(size_t)63;
+		void *mem;
+		if (posix_memalign(&mem, 64, _stride * (range? range: 1)))
+			throw _Except();
+		_slots = (char *)mem;
+		for (size_t i = 0; i < range; ++i)
+			at(i)->state = STATE_EMPTY;
+	}
+
+	~dense_array_map()
+	{
+		clear();
+		free(_slots);
+	}
+
+	iterator
+	begin()
+	{ return iterator(_slots, _slots + _stride * _range, _stride); }
+
+	iterator
+	end()
+	{
+		char *e = _slots + _stride * _range;
+		return iterator(e, e, _stride);
+	}
+
+	const_iterator
+	begin() const
+	{ return const_iterator(_slots, _slots + _stride * _range, _stride); }
+
+	const_iterator
+	end() const
+	{
+		const char *e = _slots + _stride * _range;
+		return const_iterator(e, e, _stride);
+	}
+
+	// insert or replace the value of key
+	iterator
+	insert(const _Key &key, const _Val &value)
+	{
+		slot *s = index(key);
+		if (!acquire(s, key, value))
+			update(s, value, replace_combiner(), atomic_tag<false>());
+		return iterator((char *)s, _slots + _stride * _range, _stride);
+	}
+
+	void
+	combine(const _Key &key, const _Val &value)
+	{
+		slot *s = index(key);
+		if (!acquire(s, key, value))
+			update(s, value, _combiner,
+			       atomic_tag<atomic_op<_Combiner, _Val>::value != 0>());
+	}
+
+#if __cplusplus >= 201103L
+	// the same as above, with the key and the value of a new key
+	// moved into its slot
+	void
+	combine(_Key &&key, _Val &&value)
+	{
+		slot *s = index(key);
+		if (claim(s)) {
+			new (s->_key) _Key(std::move(key));
+			new (&s->value) _Val(std::move(value));
+			publish(s);
+		} else
+			update(s, value, _combiner,
+			       atomic_tag<atomic_op<_Combiner, _Val>::value != 0>());
+	}
+#endif
+
+	// prefetch the slot of key, see storage_combine_batch
+	void
+	prefetch(const _Key &key) const
+	{
+		if ((size_t)key < _range)
+			__builtin_prefetch(at((size_t)key), 1);
+	}
+
+	iterator
+	find(const _Key &key)
+	{
+		slot *s = lookup(key);
+		return s? iterator((char *)s, _slots + _stride * _range, _stride): end();
+	}
+
+	const_iterator
+	find(const _Key &key) const
+	{
+		slot *s = lookup(key);
+		return s? const_iterator((const char *)s, _slots + _stride * _range, _stride): end();
+	}
+
+	// the value of key, which is inserted with the default value
+	// if absent
+	_Val &
+	operator[](const _Key &key)
+	{
+		slot *s = index(key);
+		acquire(s, key, _Val());
+		return s->value;
+	}
+
+	void
+	erase(const _Key &key)
+	{
+		slot *s = lookup(key);
+		if (s) {
+			s->key().~_Key();
+			s->value.~_Val();
+			s->state = STATE_EMPTY;
+			atomic_fetchadd64(&_size, -1);
+		}
+	}
+
+	void
+	clear()
+	{
+		for (size_t i = 0; i < _range; ++i) {
+			slot *s = at(i);
+			if (s->state == STATE_FULL) {
+				s->key().~_Key();
+				s->value.~_Val();
+			}
+			s->state = STATE_EMPTY;
+		}
+		_size = 0;
+	}
+
+	size_t
+	size() const
+	{ return _size; }
+
+	size_t
+	bucket_count() const
+	{ return _range; }
+
+private:
+	struct replace_combiner {
+		void
+		operator()(_Val &sum, const _Val &value) const
+		{ sum = value; }
+	};
+
+	slot *
+	at(size_t i) const
+	{ return (slot *)(_slots + _stride * i); }
+
+	slot *
+	index(const _Key &key) const
+	{
+		size_t i = (size_t)key;
+		if (i >= _range)
+			throw _Except();
+		return at(i);
+	}
+
+	// Claim the empty slot s, returns false if the key is already
+	// present. The claimer constructs the pair and then publishes
+	// the slot.
+	bool
+	claim(slot *s)
+	{
+		int64_t t = s->state;
+		if (t == STATE_EMPTY &&
+		    atomic_cmpswp64(&s->state, STATE_EMPTY, STATE_BUSY) == STATE_EMPTY)
+			return true;
+		// wait for the claimer to publish the key
+		while (s->state != STATE_FULL)
+			atomic_cpu_relax();
+		return false;
+	}
+
+	void
+	publish(slot *s)
+	{
+		atomic_barrier();
+		s->state = STATE_FULL;
+		atomic_fetchadd64(&_size, 1);
+	}
+
+	// claim the empty slot for key with value, returns false if
+	// the key is already present
+	bool
+	acquire(slot *s, const _Key &key, const _Val &value)
+	{
+		if (!claim(s))
+			return false;
+		new (s->_key) _Key(key);
+		new (&s->value) _Val(value);
+		publish(s);
+		return true;
+	}
+
+	template<typename _C>
+	void
+	update(slot *s, const _Val &value, const _C &, atomic_tag<true>)
+	{ atomic_op<_C, _Val>::apply(&s->value, value); }
+
+	// the state word doubles as the lock of the slot
+	template<typename _C>
+	void
+	update(slot *s, const _Val &value, const _C &c, atomic_tag<false>)
+	{
+		psm_backoff backoff;
+		while (atomic_cmpswp64(&s->state, STATE_FULL, STATE_BUSY) != STATE_FULL)
+			backoff();
+		c(s->value, value);
+		atomic_barrier();
+		s->state = STATE_FULL;
+	}
+
+	slot *
+	lookup(const _Key &key) const
+	{
+		size_t i = (size_t)key;
+		if (i >= _range)
+			return NULL;
+		slot *s = at(i);
+		if (s->state == STATE_EMPTY)
+			return NULL;
+		while (s->state != STATE_FULL)
+			atomic_cpu_relax();
+		return s;
+	}
+
+	dense_array_map(const dense_array_map &) { }
+
+	dense_array_map &
+	operator= (const dense_array_map &)
+	{ return *this; }
+
+	size_t		 _range;
+	size_t		 _stride;
+	char		*_slots;
+	volatile int64_t _size;
+	_Combiner	 _combiner;
+};
+
+// Whether mc_runtime hashes the keys it passes to the storage.
+// Storages indexed by the partition value itself, such as
+// dense_array_map, turn it off.
+template<template<typename _SKey, typename _SVal, typename _Except,
+		  typename _SCombiner, typename _RegionLock> class _Storage>
+struct storage_hashed {
+	enum { value = 1 };
+};
+
+template<>
+struct storage_hashed<dense_array_map> {
+	enum { value = 0 };
+};
+
+// Prefetch the slot of key in a storage. Only the storages of this
+// file can; for the others, e.g., multi_hash_map, it does nothing.
+template<typename _Storage, typename _Key>
+inline void
+storage_prefetch(const _Storage &, const _Key &)
+{ }
+
+template<typename _Key, typename _Val, typename _Except,
+	 typename _Combiner, typename _RegionLock>
+inline void
+storage_prefetch(const lockfree_hash_map<_Key, _Val, _Except, _Combiner, _RegionLock> &stor,
+		 const _Key &key)
+{ stor.prefetch(key); }
+
+template<typename _Key, typename _Val, typename _Except,
+	 typename _Combiner, typename _RegionLock>
+inline void
+storage_prefetch(const atomic_hash_map<_Key, _Val, _Except, _Combiner, _RegionLock> &stor,
+		 const _Key &key)
+{ stor.prefetch(key); }
+
+template<typename _Key, typename _Val, typename _Except,
+	 typename _Combiner, typename _RegionLock>
+inline void
+storage_prefetch(const dense_array_map<_Key, _Val, _Except, _Combiner, _RegionLock> &stor,
+		 const _Key &key)
+{ stor.prefetch(key); }
+
+// Whether storage_prefetch() does anything for a storage. Batching
+// the pairs only pays off if it does, see mc_context.
+template<typename _Storage>
+inline bool
+storage_prefetches(const _Storage &)
+{ return false; }
+
+template<typename _Key, typename _Val, typename _Except,
+	 typename _Combiner, typename _RegionLock>
+inline bool
+storage_prefetches(const lockfree_hash_map<_Key, _Val, _Except, _Combiner, _RegionLock> &)
+{ return true; }
+
+template<typename _Key, typename _Val, typename _Except,
+	 typename _Combiner, typename _RegionLock>
+inline bool
+storage_prefetches(const atomic_hash_map<_Key, _Val, _Except, _Combiner, _RegionLock> &)
+{ return true; }
+
+template<typename _Key, typename _Val, typename _Except,
+	 typename _Combiner, typename _RegionLock>
+inline bool
+storage_prefetches(const dense_array_map<_Key, _Val, _Except, _Combiner, _RegionLock> &)
+{ return true; }
+
+// Combine n pairs into a storage, group-prefetch style: the slots
+// of all keys are prefetched before any pair is combined, so that
+// their cache misses overlap rather than stall one by one.
+//     _Entry: pair-like entry with the key as first and the value
+//     as second
+template<typename _Storage, typename _Entry>
+inline void
+storage_combine_batch(_Storage &stor, const _Entry *e, size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+		storage_prefetch(stor, e[i].first);
+	for (size_t i = 0; i < n; ++i)
+		stor.combine(e[i].first, e[i].second);
+}
+
+}  // namespace mapcombine
+
+}  // namespace ulib
+
+#endif	/* _ULIB_MC_STORAGE_H */
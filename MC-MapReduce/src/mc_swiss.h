@@ -0,0 +1,709 @@
+/* The MIT License
+
+   Copyright (C) 2012 Zilong Tan (eric.zltan@gmail.com)
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   "Software"), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+
+// This file implements the SIMD-probed open addressing tables.
+// swiss_hash_map and swiss_hash_set serve the same interface as the
+// open_hash_map and open_hash_set of ulib, and are meant as the
+// sub-tables of the mapcombine containers. A table keeps one control
+// byte per slot, holding either the empty or deleted mark or a 7-bit
+// fingerprint of the hash value of the key. Probing loads a group of
+// 16 control bytes at once and compares the keys only for the slots
+// whose fingerprint matches, so a lookup rarely touches a slot of
+// another key. SSE2 is used when available, with a scalar fallback.
+// Like ulib open hashing, the tables never destruct their elements;
+// the elements are copied when the table grows.
+// Defining MC_SWISS_TABLE makes the swiss tables the default
+// sub-tables of multi_hash_set, atomic_hash_map and the private
+// contexts, see subtable_set and subtable_map.
+
+#ifndef _ULIB_MC_SWISS_H
+#define _ULIB_MC_SWISS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include <utility>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include <ulib/util_class.h>
+#include <ulib/math_rand_prot.h>
+#include <ulib/hash_open.h>
+
+namespace ulib {
+
+namespace mapcombine {
+
+// Slot management of the swiss tables.
+//     _Entry: slot content with the key as the key member
+template<typename _Key, typename _Entry, typename _Except>
+class swiss_table {
+public:
+	typedef _Key   key_type;
+	typedef size_t size_type;
+
+	// min: number of entries to make room for up front
+	swiss_table(size_t min = 0)
+		: _ctrl(NULL), _slots(NULL), _gmask(0), _size(0), _used(0)
+	{
+		if (min)
+			reserve(min);
+	}
+
+	~swiss_table()
+	{
+		free(_ctrl);
+		free(_slots);
+	}
+
+	size_t
+	size() const
+	{ return _size; }
+
+	// number of slots
+	size_t
+	bucket_count() const
+	{ return _ctrl? (_gmask + 1) * GROUP: 0; }
+
+	// Make room for n entries without rehashing. The free slots
+	// are zeroed, so that all pages of the table are first-touched
+	// by the calling thread, see multi_hash_set.
+	void
+	reserve(size_t n)
+	{
+		size_t ngroup = 1;
+		while (ngroup * GROUP * 7 < n * 8)
+			ngroup <<= 1;
+		if (_ctrl && ngroup <= _gmask + 1)
+			return;
+		rehash(ngroup);
+		for (size_t i = 0; i < bucket_count(); ++i)
+			if (_ctrl[i] < 0)
+				memset((void *)(_slots + i), 0, sizeof(_Entry));
+	}
+
+	void
+	clear()
+	{
+		if (_ctrl)
+			memset(_ctrl, CTRL_EMPTY, bucket_count());
+		_size = 0;
+		_used = 0;
+	}
+
+	// Prefetch the first group probed for the keys whose hash
+	// value, i.e., (size_t)key, is h.
+	void
+	prefetch(size_t h) const
+	{
+		if (_ctrl == NULL)
+			return;
+		size_t g = (mix(h) >> 7) & _gmask;
+		__builtin_prefetch(_ctrl + g * GROUP);
+		__builtin_prefetch(_slots + g * GROUP, 1);
+	}
+
+protected:
+	enum { GROUP = 16 };
+	enum { CTRL_EMPTY = -128, CTRL_DELETED = -2 };
+
+	// the slot of key, or npos() if absent
+	size_t
+	lookup(const _Key &key) const
+	{
+		if (_ctrl == NULL)
+			return npos();
+		uint64_t h = hash(key);
+		int8_t	 f = h & 0x7f;
+		size_t	 g = (h >> 7) & _gmask;
+		for (size_t step = 0; ; ) {
+			const int8_t *c = _ctrl + g * GROUP;
+			for (unsigned m = match(c, f); m; m &= m - 1) {
+				size_t i = g * GROUP + __builtin_ctz(m);
+				if (_slots[i].key == key)
+					return i;
+			}
+			if (match(c, CTRL_EMPTY))
+				return npos();
+			g = (g + ++step) & _gmask;
+		}
+	}
+
+	// Claim a slot for key, which must be absent. The caller
+	// constructs the entry in it.
+	size_t
+	claim(const _Key &key)
+	{
+		if (_ctrl == NULL || (_used + 1) * 8 > bucket_count() * 7)
+			rehash(_ctrl && _size * 2 < _used? _gmask + 1: (_gmask + 1) * 2 - (_ctrl == NULL));
+		uint64_t h = hash(key);
+		size_t i = free_slot(h);
+		if (_ctrl[i] == CTRL_EMPTY)
+			++_used;
+		_ctrl[i] = h & 0x7f;
+		++_size;
+		return i;
+	}
+
+	void
+	remove(size_t i)
+	{
+		_ctrl[i] = CTRL_DELETED;
+		--_size;
+	}
+
+	// the first occupied slot at or after i
+	size_t
+	next(size_t i) const
+	{
+		size_t n = bucket_count();
+		while (i < n && _ctrl[i] < 0)
+			++i;
+		return i;
+	}
+
+	static size_t
+	npos()
+	{ return (size_t)-1; }
+
+	// The ulib hash values are not mixed, and all keys of a
+	// partition share their low bits, hence the mixing.
+	static uint64_t
+	mix(uint64_t h)
+	{
+		RAND_INT3_MIX64(h);
+		return h;
+	}
+
+	static uint64_t
+	hash(const _Key &key)
+	{ return mix((size_t)key); }
+
+	// bit i set if control byte i of the group equals c
+	static unsigned
+	match(const int8_t *g, int8_t c)
+	{
+#ifdef __SSE2__
+		__m128i ctrl = _mm_load_si128((const __m128i *)g);
+		return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(c), ctrl));
+#else
+		unsigned m = 0;
+		for (int i = 0; i < GROUP; ++i)
+			m |= (unsigned)(g[i] == c) << i;
+		return m;
+#endif
+	}
+
+	// bit i set if slot i of the group is empty or deleted
+	static unsigned
+	match_free(const int8_t *g)
+	{
+#ifdef __SSE2__
+		return _mm_movemask_epi8(_mm_load_si128((const __m128i *)g));
+#else
+		unsigned m = 0;
+		for (int i = 0; i < GROUP; ++i)
+			m |= (unsigned)(g[i] < 0) << i;
+		return m;
+#endif
+	}
+
+	size_t
+	free_slot(uint64_t h) const
+	{
+		size_t g = (h >> 7) & _gmask;
+		for (size_t step = 0; ; g = (g + ++step) & _gmask) {
+			unsigned m = match_free(_ctrl + g * GROUP);
+			if (m)
+				return g * GROUP + __builtin_ctz(m);
+		}
+	}
+
+	// move the entries into ngroup groups of slots
+	void
+	rehash(size_t ngroup)
+	{
+		void *ctrl, *slots;
+		if (posix_memalign(&ctrl, GROUP, ngroup * GROUP))
+			throw _Except();
+		if (posix_memalign(&slots, 64, ngroup * GROUP * sizeof(_Entry))) {
+			free(ctrl);
+			throw _Except();
+		}
+		int8_t *octrl  = _ctrl;
+		_Entry *oslots = _slots;
+		size_t	n      = bucket_count();
+		_ctrl  = (int8_t *)ctrl;
+		_slots = (_Entry *)slots;
+		_gmask = ngroup - 1;
+		_used  = _size;
+		memset(_ctrl, CTRL_EMPTY, ngroup * GROUP);
+		for (size_t i = 0; i < n; ++i) {
+			if (octrl[i] < 0)
+				continue;
+			uint64_t h = hash(oslots[i].key);
+			size_t	 k = free_slot(h);
+			_ctrl[k] = h & 0x7f;
+			new (_slots + k) _Entry(oslots[i]);
+		}
+		free(octrl);
+		free(oslots);
+	}
+
+	int8_t *_ctrl;
+	_Entry *_slots;
+	size_t	_gmask;
+	size_t	_size;
+	// occupied and deleted slots
+	size_t	_used;
+
+private:
+	swiss_table(const swiss_table &) { }
+
+	swiss_table &
+	operator= (const swiss_table &)
+	{ return *this; }
+};
+
+template<typename _Key, typename _Val>
+struct swiss_map_entry {
+	swiss_map_entry(const _Key &k, const _Val &v)
+		: key(k), value(v) { }
+
+#if __cplusplus >= 201103L
+	swiss_map_entry(_Key &&k, _Val &&v)
+		: key(std::move(k)), value(std::move(v)) { }
+#endif
+
+	_Key key;
+	_Val value;
+};
+
+// SIMD-probed hash map, see swiss_table.
+template<typename _Key, typename _Val, typename _Except = ulib_except>
+class swiss_hash_map : public swiss_table<_Key, swiss_map_entry<_Key, _Val>, _Except> {
+public:
+	typedef swiss_table<_Key, swiss_map_entry<_Key, _Val>, _Except> table_type;
+	typedef _Val value_type;
+
+	swiss_hash_map(size_t min = 0)
+		: table_type(min) { }
+
+	struct iterator
+	{
+		iterator(swiss_hash_map *t, size_t i)
+			: _t(t), _i(i) { }
+
+		iterator() { }
+
+		_Key &
+		key() const
+		{ return _t->_slots[_i].key; }
+
+		_Val &
+		value() const
+		{ return _t->_slots[_i].value; }
+
+		iterator &
+		operator++()
+		{
+			_i = _t->next(_i + 1);
+			return *this;
+		}
+
+		iterator
+		operator++(int)
+		{
+			iterator old = *this;
+			++*this;
+			return old;
+		}
+
+		bool
+		operator==(const iterator &other) const
+		{ return _i == other._i; }
+
+		bool
+		operator!=(const iterator &other) const
+		{ return _i != other._i; }
+
+		swiss_hash_map *_t;
+		size_t _i;
+	};
+
+	struct const_iterator
+	{
+		const_iterator(const swiss_hash_map *t, size_t i)
+			: _t(t), _i(i) { }
+
+		const_iterator(const iterator &it)
+			: _t(it._t), _i(it._i) { }
+
+		const_iterator() { }
+
+		const _Key &
+		key() const
+		{ return _t->_slots[_i].key; }
+
+		const _Val &
+		value() const
+		{ return _t->_slots[_i].value; }
+
+		const_iterator &
+		operator++()
+		{
+			_i = _t->next(_i + 1);
+			return *this;
+		}
+
+		const_iterator
+		operator++(int)
+		{
+			const_iterator old = *this;
+			++*this;
+			return old;
+		}
+
+		bool
+		operator==(const const_iterator &other) const
+		{ return _i == other._i; }
+
+		bool
+		operator!=(const const_iterator &other) const
+		{ return _i != other._i; }
+
+		const swiss_hash_map *_t;
+		size_t _i;
+	};
+
+	iterator
+	begin()
+	{ return iterator(this, this->next(0)); }
+
+	iterator
+	end()
+	{ return iterator(this, this->bucket_count()); }
+
+	const_iterator
+	begin() const
+	{ return const_iterator(this, this->next(0)); }
+
+	const_iterator
+	end() const
+	{ return const_iterator(this, this->bucket_count()); }
+
+	iterator
+	find(const _Key &key)
+	{
+		size_t i = this->lookup(key);
+		return i == table_type::npos()? end(): iterator(this, i);
+	}
+
+	const_iterator
+	find(const _Key &key) const
+	{
+		size_t i = this->lookup(key);
+		return i == table_type::npos()? end(): const_iterator(this, i);
+	}
+
+	bool
+	contain(const _Key &key) const
+	{ return this->lookup(key) != table_type::npos(); }
+
+	// insert or replace the value of key
+	iterator
+	insert(const _Key &key, const _Val &value)
+	{
+		size_t i = this->lookup(key);
+		if (i != table_type::npos())
+			this->_slots[i].value = value;
+		else {
+			i = this->claim(key);
+			new (this->_slots + i) swiss_map_entry<_Key, _Val>(key, value);
+		}
+		return iterator(this, i);
+	}
+
+#if __cplusplus >= 201103L
+	// the same as above, with key and value moved into the table
+	iterator
+	insert(_Key &&key, _Val &&value)
+	{
+		size_t i = this->lookup(key);
+		if (i != table_type::npos())
+			this->_slots[i].value = std::move(value);
+		else {
+			i = this->claim(key);
+			new (this->_slots + i) swiss_map_entry<_Key, _Val>(
+				std::move(key), std::move(value));
+		}
+		return iterator(this, i);
+	}
+#endif
+
+	_Val &
+	operator[](const _Key &key)
+	{
+		size_t i = this->lookup(key);
+		if (i == table_type::npos()) {
+			i = this->claim(key);
+			new (this->_slots + i) swiss_map_entry<_Key, _Val>(key, _Val());
+		}
+		return this->_slots[i].value;
+	}
+
+	void
+	erase(const _Key &key)
+	{
+		size_t i = this->lookup(key);
+		if (i != table_type::npos())
+			this->remove(i);
+	}
+
+	void
+	erase(const iterator &it)
+	{ this->remove(it._i); }
+};
+
+template<typename _Key>
+struct swiss_set_entry {
+	swiss_set_entry(const _Key &k)
+		: key(k) { }
+
+	_Key key;
+};
+
+// SIMD-probed hash set, see swiss_table.
+template<typename _Key, typename _Except = ulib_except>
+class swiss_hash_set : public swiss_table<_Key, swiss_set_entry<_Key>, _Except> {
+public:
+	typedef swiss_table<_Key, swiss_set_entry<_Key>, _Except> table_type;
+
+	swiss_hash_set(size_t min = 0)
+		: table_type(min) { }
+
+	struct iterator
+	{
+		iterator(swiss_hash_set *t, size_t i)
+			: _t(t), _i(i) { }
+
+		iterator() { }
+
+		_Key &
+		key() const
+		{ return _t->_slots[_i].key; }
+
+		bool
+		value() const
+		{ return true; }
+
+		iterator &
+		operator++()
+		{
+			_i = _t->next(_i + 1);
+			return *this;
+		}
+
+		iterator
+		operator++(int)
+		{
+			iterator old = *this;
+			++*this;
+			return old;
+		}
+
+		bool
+		operator==(const iterator &other) const
+		{ return _i == other._i; }
+
+		bool
+		operator!=(const iterator &other) const
+		{ return _i != other._i; }
+
+		swiss_hash_set *_t;
+		size_t _i;
+	};
+
+	struct const_iterator
+	{
+		const_iterator(const swiss_hash_set *t, size_t i)
+			: _t(t), _i(i) { }
+
+		const_iterator(const iterator &it)
+			: _t(it._t), _i(it._i) { }
+
+		const_iterator() { }
+
+		const _Key &
+		key() const
+		{ return _t->_slots[_i].key; }
+
+		bool
+		value() const
+		{ return true; }
+
+		const_iterator &
+		operator++()
+		{
+			_i = _t->next(_i + 1);
+			return *this;
+		}
+
+		const_iterator
+		operator++(int)
+		{
+			const_iterator old = *this;
+			++*this;
+			return old;
+		}
+
+		bool
+		operator==(const const_iterator &other) const
+		{ return _i == other._i; }
+
+		bool
+		operator!=(const const_iterator &other) const
+		{ return _i != other._i; }
+
+		const swiss_hash_set *_t;
+		size_t _i;
+	};
+
+	iterator
+	begin()
+	{ return iterator(this, this->next(0)); }
+
+	iterator
+	end()
+	{ return iterator(this, this->bucket_count()); }
+
+	const_iterator
+	begin() const
+	{ return const_iterator(this, this->next(0)); }
+
+	const_iterator
+	end() const
+	{ return const_iterator(this, this->bucket_count()); }
+
+	iterator
+	find(const _Key &key)
+	{
+		size_t i = this->lookup(key);
+		return i == table_type::npos()? end(): iterator(this, i);
+	}
+
+	const_iterator
+	find(const _Key &key) const
+	{
+		size_t i = this->lookup(key);
+		return i == table_type::npos()? end(): const_iterator(this, i);
+	}
+
+	bool
+	contain(const _Key &key) const
+	{ return this->lookup(key) != table_type::npos(); }
+
+	iterator
+	insert(const _Key &key)
+	{
+		size_t i = this->lookup(key);
+		if (i == table_type::npos()) {
+			i = this->claim(key);
+			new (this->_slots + i) swiss_set_entry<_Key>(key);
+		}
+		return iterator(this, i);
+	}
+
+	void
+	erase(const _Key &key)
+	{
+		size_t i = this->lookup(key);
+		if (i != table_type::npos())
+			this->remove(i);
+	}
+
+	void
+	erase(const iterator &it)
+	{ this->remove(it._i); }
+};
+
+// Sub-table types of the mapcombine containers.
+template<typename _Key, typename _Except = ulib_except>
+struct subtable_set {
+#ifdef MC_SWISS_TABLE
+	typedef swiss_hash_set<_Key, _Except> type;
+#else
+	typedef open_hash_set<_Key, _Except> type;
+#endif
+};
+
+template<typename _Key, typename _Val, typename _Except = ulib_except>
+struct subtable_map {
+#ifdef MC_SWISS_TABLE
+	typedef swiss_hash_map<_Key, _Val, _Except> type;
+#else
+	typedef open_hash_map<_Key, _Val, _Except> type;
+#endif
+};
+
+// Prefetch the slots of sub-table t probed for hash value h. Only
+// the swiss tables can; for the others it does nothing.
+template<typename _Table>
+inline void
+subtable_prefetch(const _Table &, size_t)
+{ }
+
+template<typename _Key, typename _Except>
+inline void
+subtable_prefetch(const swiss_hash_set<_Key, _Except> &t, size_t h)
+{ t.prefetch(h); }
+
+template<typename _Key, typename _Val, typename _Except>
+inline void
+subtable_prefetch(const swiss_hash_map<_Key, _Val, _Except> &t, size_t h)
+{ t.prefetch(h); }
+
+#if __cplusplus >= 201103L
+// Insert the absent key into sub-table t, moving the value in. The
+// swiss tables construct the entry from it; open hashing can only
+// take copies, so the value is moved over the default one instead.
+template<typename _Table, typename _Key, typename _Val>
+inline void
+subtable_emplace(_Table &t, _Key &&key, _Val &&value)
+{ t[key] = std::move(value); }
+
+template<typename _Key, typename _Val, typename _Except>
+inline void
+subtable_emplace(swiss_hash_map<_Key, _Val, _Except> &t, _Key &&key, _Val &&value)
+{ t.insert(std::move(key), std::move(value)); }
+#endif
+
+}  // namespace mapcombine
+
+}  // namespace ulib
+
+#endif	/* _ULIB_MC_SWISS_H */
@@ -30,21 +30,80 @@
 // the queue as done. If other threads arrive while the section is in
 // use, load from the other threads will be delivered to the working
 // thread. Thus the working thread acts as a 'proxy'.
+// A proxy may be bounded: after a given number of items it offers
+// the rest of the queue to the next arriving thread and returns to
+// its own work if one shows up shortly.
 
 #ifndef _ULIB_MC_SYNC_H
 #define _ULIB_MC_SYNC_H
 
 #include <stddef.h>
+#include <sched.h>
+#include <new>
+#include <utility>
 #include <ulib/os_atomic_intel64.h>
+#include <ulib/mc_alloc.h>
 
 namespace ulib {
 
 namespace mapcombine {
 
+// Exponential backoff for the PSM waits.
+// Each wait spins twice as long as the last one until the limit is
+// reached, after which the processor is yielded, so that a waiter
+// does not starve a preempted thread it waits for.
+class psm_backoff {
+public:
+	psm_backoff(unsigned limit = 1024)
+		: _spin(1), _limit(limit) { }
+
+	void
+	operator()()
+	{
+		if (_spin > _limit) {
+			sched_yield();
+			return;
+		}
+		for (unsigned i = 0; i < _spin; ++i)
+			atomic_cpu_relax();
+		_spin <<= 1;
+	}
+
+private:
+	unsigned _spin;
+	unsigned _limit;
+};
+
+// Number of spins for which a bounded proxy keeps its queue open
+// waiting for another thread to take over.
+#define PSM_HANDOFF_SPIN 256
+
 // PSM data node
+// The nodes are created by the emitting threads and mostly destroyed
+// by the proxies, hence they come from the per-thread pools.
 template<typename T>
 struct psm_node {
 	psm_node(const T &d) : next(NULL), data(d) { }
+
+	// construct the data in place from its constructor arguments
+#if __cplusplus >= 201103L
+	template<typename A, typename B>
+	psm_node(A &&a, B &&b)
+		: next(NULL), data(std::forward<A>(a), std::forward<B>(b)) { }
+#else
+	template<typename A, typename B>
+	psm_node(const A &a, const B &b)
+		: next(NULL), data(a, b) { }
+#endif
+
+	static void *
+	operator new(size_t)
+	{ return object_pool<psm_node>::alloc(); }
+
+	static void
+	operator delete(void *p)
+	{ object_pool<psm_node>::free(p); }
+
 	psm_node *next;
 	T data;
 };
@@ -56,11 +115,64 @@ struct psm_queue {
 	psm_node<T> *tail;
 };
 
+// PSM batch node
+// A batch carries up to CAPACITY data for the same queue.
+template<typename T>
+struct psm_batch {
+	enum { CAPACITY = 16 };
+
+	psm_batch() : next(NULL), size(0) { }
+
+	~psm_batch()
+	{
+		for (size_t i = 0; i < size; ++i)
+			data()[i].~T();
+	}
+
+	void
+	push(const T &d)
+	{ new (data() + size++) T(d); }
+
+	bool
+	full() const
+	{ return size == CAPACITY; }
+
+	T *
+	data()
+	{ return (T *)_buf; }
+
+	static void *
+	operator new(size_t)
+	{ return object_pool<psm_batch>::alloc(); }
+
+	static void
+	operator delete(void *p)
+	{ object_pool<psm_batch>::free(p); }
+
+	psm_batch *next;
+	size_t size;
+
+private:
+	union {
+		char _buf[sizeof(T) * CAPACITY];
+		long double _align;
+	};
+};
+
+// PSM batch queue.
+template<typename T>
+struct psm_batch_queue {
+	psm_batch_queue() : tail(NULL) { }
+	psm_batch<T> *tail;
+};
+
 // Process the queued data.
 //     q: the psm queue
 //     data: new data to append to the queue
 //     set: the set to combine the data
-// Queued data will be combined into the set.
+// Queued data will be combined into the set. Each dequeued node is
+// wrapped in an S::node_ref, which is passed to set.combine() and
+// reclaims the node unless the set takes it over.
 template<typename T, typename S>
 static inline void psm_process_cas(psm_queue<T> &q, const T &data, S &set)
 {
@@ -74,14 +186,15 @@ static inline void psm_process_cas(psm_queue<T> &q, const T &data, S &set)
 
 	// flush the queue
 	for (;;) {
-		typename S::key_type key(node);  // automatically reclaim memory
-		set.combine(key);
+		typename S::node_ref ref(node);  // automatically reclaim memory
+		set.combine(ref);
 		if (node->next == NULL) {  // seemingly no successor
 			if (atomic_cmpswp64(&q.tail, (int64_t)node, 0) == (int64_t)node)
 				return;
 			// got successors, wait for them to appear
+			psm_backoff backoff;
 			while (node->next == NULL)
-				atomic_cpu_relax();
+				backoff();
 		}
 		node = node->next;
 	}
@@ -89,13 +202,15 @@ static inline void psm_process_cas(psm_queue<T> &q, const T &data, S &set)
 
 // Another version using FAS instead of CAS
 //     q: the psm queue
-//     data: new data to append to the queue
+//     node: new node to append to the queue, which the queue takes
+//     over
 //     set: the set to combine the data
+//     limit: number of items after which the proxy offers the
+//     queue to others, zero means unbounded
 // Queued data will be combined into the set.
 template<typename T, typename S>
-static inline void psm_process_fas(psm_queue<T> &q, const T &data, S &set)
+static inline void psm_process_fas(psm_queue<T> &q, psm_node<T> *node, S &set, size_t limit = 0)
 {
-	psm_node<T> *node = new psm_node<T>(data);
 	psm_node<T> *pred = (psm_node<T> *)atomic_fetchstore64(&q.tail, (int64_t)node);
 
 	if (pred) {
@@ -104,18 +219,28 @@ static inline void psm_process_fas(psm_queue<T> &q, const T &data, S &set)
 	}
 
 	// flush the queue
+	size_t n = 0;
 	for (;;) {
-		typename S::key_type key(node);  // automatically reclaim memory
-		set.combine(key);
-		if (node->next == NULL) {  // seemingly no successor
+		typename S::node_ref ref(node);  // automatically reclaim memory
+		set.combine(ref);
+		bool handoff = limit && ++n == limit;
+		if (node->next == NULL || handoff) {  // seemingly no successor
 			pred = (psm_node<T> *)atomic_fetchstore64(&q.tail, 0);
 			if (pred == node)
 				return;
+			if (handoff) {
+				// keep the queue empty for a while, the
+				// next arriving thread becomes the proxy
+				n = 0;
+				for (int i = 0; i < PSM_HANDOFF_SPIN && q.tail == NULL; ++i)
+					atomic_cpu_relax();
+			}
 			psm_node<T> *succ = (psm_node<T> *)
 				atomic_fetchstore64(&q.tail, (int64_t)pred);
 			// got successors, wait for them to appear
+			psm_backoff backoff;
 			while (node->next == NULL)
-				atomic_cpu_relax();
+				backoff();
 			if (succ) {
 				succ->next = node->next;
 				return;
@@ -125,6 +250,66 @@ static inline void psm_process_fas(psm_queue<T> &q, const T &data, S &set)
 	}
 }
 
+// The same as above for a datum, which is copied into a new node.
+template<typename T, typename S>
+static inline void psm_process_fas(psm_queue<T> &q, const T &data, S &set, size_t limit = 0)
+{ psm_process_fas(q, new psm_node<T>(data), set, limit); }
+
+// Batched version of psm_process_fas
+//     q: the psm batch queue
+//     batch: new batch to append to the queue, which is deleted
+//     once combined
+//     set: the set to combine the data
+//     limit: see psm_process_fas, counted in data
+// The data of each batch are combined at once with
+// set.combine_batch().
+template<typename T, typename S>
+static inline void psm_process_batch(psm_batch_queue<T> &q, psm_batch<T> *batch, S &set,
+				     size_t limit = 0)
+{
+	psm_batch<T> *node = batch;
+	psm_batch<T> *pred = (psm_batch<T> *)atomic_fetchstore64(&q.tail, (int64_t)node);
+
+	if (pred) {
+		pred->next = node;
+		return;
+	}
+
+	// flush the queue
+	size_t n = 0;
+	for (;;) {
+		set.combine_batch(node->data(), node->size);
+		psm_batch<T> *next = node->next;
+		bool handoff = limit && (n += node->size) >= limit;
+		if (next == NULL || handoff) {  // seemingly no successor
+			pred = (psm_batch<T> *)atomic_fetchstore64(&q.tail, 0);
+			if (pred == node) {
+				delete node;
+				return;
+			}
+			if (handoff) {
+				n = 0;
+				for (int i = 0; i < PSM_HANDOFF_SPIN && q.tail == NULL; ++i)
+					atomic_cpu_relax();
+			}
+			psm_batch<T> *succ = (psm_batch<T> *)
+				atomic_fetchstore64(&q.tail, (int64_t)pred);
+			// got successors, wait for them to appear
+			psm_backoff backoff;
+			while (node->next == NULL)
+				backoff();
+			next = node->next;
+			if (succ) {
+				succ->next = next;
+				delete node;
+				return;
+			}
+		}
+		delete node;
+		node = next;
+	}
+}
+
 }  // namespace mapcombine
 
 }  // namespace mapcombine
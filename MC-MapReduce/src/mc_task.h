@@ -26,58 +26,46 @@
 #ifndef _ULIB_MC_TASK_H
 #define _ULIB_MC_TASK_H
 
-#ifndef _GNU_SOURCE
-#define _GNU_SOURCE
-#endif
-#include <pthread.h>
-
-#include <unistd.h>
-#include <ulib/os_thread.h>
+#include <stddef.h>
 #include <ulib/mc_typedef.h>
 
 namespace ulib {
 
 namespace mapcombine {
 
+// Placeholder for the absence of a mapper prototype, see task.
+struct no_prototype { };
+
 // Parallel task prototype.
-// Each task owns a unique data chunk and works on that chunk.
+// A task is the mapper instance of a worker, it processes the data
+// chunks given to that worker. The mapper is constructed from the
+// pipeline and, if one is given to the runtime, a prototype, e.g.,
+// the function object of func_mapper, which every task copies.
 template<typename _Chunk, typename _Pipeline, typename _Mapper>
-class task : public _Mapper, public thread
+class task : public _Mapper
 {
 public:
 	typedef _Chunk	  chunk_type;
 	typedef _Pipeline pipeline_type;
 	typedef _Mapper	  mapper_type;
 
-	task(int cpuid, const chunk_type &chunk, pipeline_type &pipe)
-		: mapper_type(pipe), _cpuid(cpuid), _chunk(chunk) { }
+	task(pipeline_type &pipe, const no_prototype & = no_prototype())
+		: mapper_type(pipe) { }
 
-	virtual
-	~task()
-	{ stop_and_join(); }
+	template<typename _Proto>
+	task(pipeline_type &pipe, const _Proto &proto)
+		: mapper_type(pipe, proto) { }
 
-private:
-	int
-	setup()
-	{
-		// each task is assigned to a unique processor
-		cpu_set_t cpu_set;
-		CPU_ZERO(&cpu_set);
-		CPU_SET(_cpuid, &cpu_set);
-		return pthread_setaffinity_np(thread::_tid, sizeof(cpu_set), &cpu_set);
-	}
-
-	int
-	run()
+	// The mapper is called by its qualified name, which binds
+	// statically, so that its body is inlined into the loop
+	// rather than called virtually per record.
+	void
+	run(chunk_type chunk)
 	{
 		// iteratively process the chunk
-		for (typename chunk_type::iterator it = _chunk.begin(); it != _chunk.end(); ++it)
-			(*this)(*it);
-		return 0;
+		for (typename chunk_type::iterator it = chunk.begin(); it != chunk.end(); ++it)
+			mapper_type::operator()(*it);
 	}
-
-	int	   _cpuid;
-	chunk_type _chunk;
 };
 
 }  // namespace mapcombine
@@ -0,0 +1,224 @@
+/* The MIT License
+
+   Copyright (C) 2012 Zilong Tan (eric.zltan@gmail.com)
+
+   Permission is hereby granted, free of charge, to any person
+   obtaining a copy of this software and associated documentation
+   files (the "Software"), to deal in the Software without
+   restriction, including without limitation the rights to use, copy,
+   modify, merge, publish, distribute, sublicense, and/or sell copies
+   of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+// This file implements the topology-aware CPU placement.
+// The placement is built from the affinity mask of the process,
+// which honors the cpusets of containers, and from the sysfs CPU
+// topology. Processors are ordered such that all physical cores are
+// used before any SMT sibling, either filling one socket after
+// another (compact) or alternating between sockets (spread). The
+// NUMA node of each processor is recorded for node-local memory
+// placement, see mc_numa.h.
+
+#ifndef _ULIB_MC_TOPOLOGY_H
+#define _ULIB_MC_TOPOLOGY_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <sched.h>
+
+#include <stdio.h>
+#include <dirent.h>
+#include <stddef.h>
+#include <vector>
+#include <algorithm>
+#include <ulib/util_log.h>
+
+namespace ulib {
+
+namespace mapcombine {
+
+enum placement_policy {
+	place_compact,	// fill the cores of one socket before the next
+	place_spread,	// distribute consecutive workers over sockets
+	place_linear	// ascending processor ids, ignoring topology
+};
+
+struct cpu_info {
+	int cpu;
+	int package;	// physical socket
+	int node;	// NUMA node
+	int core;	// core id as reported by sysfs
+	int index;	// core index within the package
+	int smt;	// rank among the siblings of the core
+};
+
+class cpu_placement {
+public:
+	// policy: how workers are placed
+	// exclude: processors not to use, NULL to use every allowed one
+	cpu_placement(placement_policy policy = place_compact,
+		      const cpu_set_t *exclude = NULL)
+	{
+		cpu_set_t allowed;
+		CPU_ZERO(&allowed);
+		if (sched_getaffinity(0, sizeof(allowed), &allowed)) {
+			ULIB_WARNING("sched_getaffinity failed, assume all processors allowed");
+			for (int c = 0; c < CPU_SETSIZE; ++c)
+				CPU_SET(c, &allowed);
+		}
+		for (int c = 0; c < CPU_SETSIZE; ++c) {
+			if (!CPU_ISSET(c, &allowed) || (exclude && CPU_ISSET(c, exclude)))
+				continue;
+			cpu_info ci;
+			ci.cpu = c;
+			ci.package = read_topology(c, "physical_package_id", 0);
+			ci.core = read_topology(c, "core_id", c);
+			ci.node = read_node(c);
+			_cpus.push_back(ci);
+		}
+		if (_cpus.empty()) {
+			ULIB_FATAL("no processor available for placement");
+			cpu_info ci = { 0, 0, 0, 0, 0, 0 };
+			_cpus.push_back(ci);
+			return;
+		}
+		// rank cores within packages and siblings within cores
+		std::sort(_cpus.begin(), _cpus.end(), by_core());
+		for (size_t i = 0; i < _cpus.size(); ++i) {
+			if (i == 0 || _cpus[i].package != _cpus[i - 1].package) {
+				_cpus[i].index = 0;
+				_cpus[i].smt = 0;
+			} else if (_cpus[i].core != _cpus[i - 1].core) {
+				_cpus[i].index = _cpus[i - 1].index + 1;
+				_cpus[i].smt = 0;
+			} else {
+				_cpus[i].index = _cpus[i - 1].index;
+				_cpus[i].smt = _cpus[i - 1].smt + 1;
+			}
+		}
+		switch (policy) {
+		case place_compact:
+			std::sort(_cpus.begin(), _cpus.end(), compact_order());
+			break;
+		case place_spread:
+			std::sort(_cpus.begin(), _cpus.end(), spread_order());
+			break;
+		default:
+			std::sort(_cpus.begin(), _cpus.end(), linear_order());
+		}
+	}
+
+	// number of usable processors
+	size_t
+	size() const
+	{ return _cpus.size(); }
+
+	// processor for the n-th worker, wrapping around when there
+	// are more workers than processors
+	int
+	operator[](size_t n) const
+	{ return _cpus[n % _cpus.size()].cpu; }
+
+	const cpu_info &
+	info(size_t n) const
+	{ return _cpus[n % _cpus.size()]; }
+
+private:
+	// read a topology attribute, def if unavailable
+	static int
+	read_topology(int cpu, const char *attr, int def)
+	{
+		char path[128];
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, attr);
+		FILE *fp = fopen(path, "r");
+		if (fp == NULL)
+			return def;
+		int val;
+		if (fscanf(fp, "%d", &val) != 1)
+			val = def;
+		fclose(fp);
+		return val;
+	}
+
+	// the node of a processor is given by its nodeN entry
+	static int
+	read_node(int cpu)
+	{
+		char path[128];
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+		DIR *dir = opendir(path);
+		if (dir == NULL)
+			return 0;
+		int node = 0;
+		struct dirent *ent;
+		while ((ent = readdir(dir)) != NULL) {
+			if (sscanf(ent->d_name, "node%d", &node) == 1)
+				break;
+		}
+		closedir(dir);
+		return node;
+	}
+
+	struct by_core {
+		bool
+		operator()(const cpu_info &a, const cpu_info &b) const
+		{
+			if (a.package != b.package)
+				return a.package < b.package;
+			if (a.core != b.core)
+				return a.core < b.core;
+			return a.cpu < b.cpu;
+		}
+	};
+
+	struct compact_order {
+		bool
+		operator()(const cpu_info &a, const cpu_info &b) const
+		{
+			if (a.smt != b.smt)
+				return a.smt < b.smt;
+			if (a.package != b.package)
+				return a.package < b.package;
+			return a.index < b.index;
+		}
+	};
+
+	struct spread_order {
+		bool
+		operator()(const cpu_info &a, const cpu_info &b) const
+		{
+			if (a.smt != b.smt)
+				return a.smt < b.smt;
+			if (a.index != b.index)
+				return a.index < b.index;
+			return a.package < b.package;
+		}
+	};
+
+	struct linear_order {
+		bool
+		operator()(const cpu_info &a, const cpu_info &b) const
+		{ return a.cpu < b.cpu; }
+	};
+
+	std::vector<cpu_info> _cpus;
+};
+
+}  // namespace mapcombine
+
+}  // namespace ulib
+
+#endif	/* _ULIB_MC_TOPOLOGY_H */
@@ -26,6 +26,10 @@
 #ifndef _ULIB_MC_TYPEDEF_H
 #define _ULIB_MC_TYPEDEF_H
 
+#include <stdint.h>
+#include <stddef.h>
+#include <algorithm>
+#include <utility>
 #include <ulib/math_rand_prot.h>
 
 namespace ulib {
@@ -59,6 +63,28 @@ struct additive_combiner : public combiner<_Val> {
 	{ sum += value; }
 };
 
+// These combiners keep the minimum and the maximum of the values
+// respectively, using the < operator of the value.
+template<typename _Val>
+struct min_combiner : public combiner<_Val> {
+	void
+	operator()(_Val &sum, const _Val &value) const
+	{
+		if (value < sum)
+			sum = value;
+	}
+};
+
+template<typename _Val>
+struct max_combiner : public combiner<_Val> {
+	void
+	operator()(_Val &sum, const _Val &value) const
+	{
+		if (sum < value)
+			sum = value;
+	}
+};
+
 // The mapper prototype.
 //     _Pipeline: intermediate runtime context, users need not care
 //     about the meaning of it.
@@ -66,7 +92,9 @@ struct additive_combiner : public combiner<_Val> {
 //     _Key: the type of key to emit
 //     _Val: the type of value to emit
 //
-// Multiple emits are allowed for a record.
+// Multiple emits are allowed for a record. emit_batch emits n pairs
+// at once, hashing their keys together (see mix_hashes), which pays
+// off when a record yields many pairs.
 template<typename _Pipeline, typename _Record, typename _Key, typename _Val>
 class psm_mapper {
 public:
@@ -82,9 +110,31 @@ public:
 
 	void
 	emit(const _Key &key, const _Val &value)
-	{ _pipeline.process(typename pipeline_type::data_type(key, value)); }
+	{ _pipeline.emplace(key, value); }
+
+#if __cplusplus >= 201103L
+	// move the key and the value into the pipeline
+	void
+	emit(_Key &&key, _Val &&value)
+	{ _pipeline.emplace(std::move(key), std::move(value)); }
+#endif
+
+	void
+	emit_batch(const _Key *keys, const _Val *values, size_t n)
+	{
+		typedef typename pipeline_type::data_type data_type;
+		uint64_t h[EMIT_BATCH];
+		for (size_t i = 0; i < n; i += EMIT_BATCH) {
+			size_t m = std::min(n - i, (size_t)EMIT_BATCH);
+			data_type::hash_batch(keys + i, h, m);
+			for (size_t k = 0; k < m; ++k)
+				_pipeline.process(data_type(keys[i + k], values[i + k], h[k]));
+		}
+	}
 
 protected:
+	enum { EMIT_BATCH = 64 };
+
 	pipeline_type &_pipeline;
 };
 
@@ -106,10 +156,81 @@ public:
 	emit(const _Key &key, const _Val &value)
 	{ _storage.combine(key, value); }
 
+#if __cplusplus >= 201103L
+	// move the key and the value into the storage
+	void
+	emit(_Key &&key, _Val &&value)
+	{ _storage.combine(typename storage_type::key_type(std::move(key)), std::move(value)); }
+#endif
+
+	// see psm_mapper
+	void
+	emit_batch(const _Key *keys, const _Val *values, size_t n)
+	{
+		typedef typename storage_type::key_type skey_type;
+		uint64_t h[EMIT_BATCH];
+		for (size_t i = 0; i < n; i += EMIT_BATCH) {
+			size_t m = std::min(n - i, (size_t)EMIT_BATCH);
+			skey_type::hash_batch(keys + i, h, m);
+			for (size_t k = 0; k < m; ++k)
+				_storage.combine(skey_type(keys[i + k], h[k]), values[i + k]);
+		}
+	}
+
 protected:
+	enum { EMIT_BATCH = 64 };
+
 	storage_type &_storage;
 };
 
+// Mapper adapter for function objects.
+//     _Func: function object type, called as func(rec, mapper) for
+//     each record, where mapper offers emit() and emit_batch()
+// The nested psm and mc templates are the mappers of psm_runtime and
+// mc_runtime respectively, e.g., func_mapper<R, K, V, F>::template
+// psm. Each task copies the function object given to run(ntask,
+// func), so it may carry state, e.g., parameters or a lambda
+// capture; with plain run(ntask) it is default constructed instead.
+// As task calls the mapper statically, the function object is
+// inlined into the chunk loop; nothing needs to derive from the
+// mapper prototypes.
+template<typename _Record, typename _Key, typename _Val, typename _Func>
+struct func_mapper {
+	template<typename _Pipeline>
+	class psm : public psm_mapper<_Pipeline, _Record, _Key, _Val> {
+	public:
+		psm(_Pipeline &pipe)
+			: psm_mapper<_Pipeline, _Record, _Key, _Val>(pipe) { }
+
+		psm(_Pipeline &pipe, const _Func &func)
+			: psm_mapper<_Pipeline, _Record, _Key, _Val>(pipe), _func(func) { }
+
+		void
+		operator()(const _Record &rec)
+		{ _func(rec, *this); }
+
+	private:
+		_Func _func;
+	};
+
+	template<typename _Storage>
+	class mc : public mc_mapper<_Storage, _Record, _Key, _Val> {
+	public:
+		mc(_Storage &stor)
+			: mc_mapper<_Storage, _Record, _Key, _Val>(stor) { }
+
+		mc(_Storage &stor, const _Func &func)
+			: mc_mapper<_Storage, _Record, _Key, _Val>(stor), _func(func) { }
+
+		void
+		operator()(const _Record &rec)
+		{ _func(rec, *this); }
+
+	private:
+		_Func _func;
+	};
+};
+
 // The key partition prototype.
 // The key is provided in the mapper.
 template<typename _Key>